@@ -0,0 +1,216 @@
+/*
+ * Copyright (c) 2018 Kay Gawlik <kaydev@amarunet.de> <kay.gawlik@beuth-hochschule.de> <kay.gawlik@charite.de>
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "benchmark.h"
+
+#include "../helper/call_statistics.h"
+
+#include <octdata/datastruct/oct.h>
+#include <octdata/datastruct/sloimage.h>
+#include <octdata/datastruct/bscan.h>
+
+#include <opencv2/opencv.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+
+namespace
+{
+	std::atomic<std::uint64_t> numNew(0);
+
+	bool parseArgument(const char* arg, const char* name, std::string& value)
+	{
+		const std::size_t length = std::strlen(name);
+		if(std::strncmp(arg, name, length) != 0 || arg[length] != '=')
+			return false;
+		value = arg + length + 1;
+		return true;
+	}
+
+	bool parseArgument(const char* arg, const char* name, std::size_t& value)
+	{
+		std::string str;
+		if(!parseArgument(arg, name, str))
+			return false;
+		value = std::strtoull(str.c_str(), nullptr, 10);
+		return true;
+	}
+}
+
+
+// counts all operator new calls of the benchmark process
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+	#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void* operator new(std::size_t size)
+{
+	++numNew;
+	if(void* ptr = std::malloc(size > 0 ? size : 1))
+		return ptr;
+	throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size)
+{
+	return operator new(size);
+}
+
+void operator delete(void* ptr) noexcept
+{
+	std::free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept
+{
+	std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept
+{
+	std::free(ptr);
+}
+
+void operator delete[](void* ptr, std::size_t) noexcept
+{
+	std::free(ptr);
+}
+
+
+namespace Benchmark
+{
+	std::uint64_t Config::getDataBytes() const
+	{
+		const std::uint64_t imageBytes = static_cast<std::uint64_t>(width)*height;
+		const std::uint64_t segBytes   = static_cast<std::uint64_t>(width)*numLayers*sizeof(double);
+		return (imageBytes + segBytes)*numBScans;
+	}
+
+	Config parseArguments(int argc, char* argv[])
+	{
+		Config config;
+		for(int i = 1; i < argc; ++i)
+		{
+			const char* arg = argv[i];
+			if(!parseArgument(arg, "--bscans"     , config.numBScans  )
+			&& !parseArgument(arg, "--width"      , config.width      )
+			&& !parseArgument(arg, "--height"     , config.height     )
+			&& !parseArgument(arg, "--layers"     , config.numLayers  )
+			&& !parseArgument(arg, "--repetitions", config.repetitions)
+			&& !parseArgument(arg, "--filter"     , config.filter     ))
+			{
+				std::fprintf(stderr, "unknown argument %s\n"
+				                     "arguments: --bscans=N --width=N --height=N --layers=N --repetitions=N --filter=text\n", arg);
+				std::exit(EXIT_FAILURE);
+			}
+		}
+		return config;
+	}
+
+	std::unique_ptr<OctData::OCT> createSyntheticOct(const Config& config)
+	{
+		std::unique_ptr<OctData::OCT> oct = std::make_unique<OctData::OCT>();
+		OctData::Series& series = oct->getInsertId(1).getInsertId(1).getInsertId(1);
+
+		const int rows = static_cast<int>(config.height);
+		const int cols = static_cast<int>(config.width);
+
+		cv::Mat sloImage(rows, rows, CV_8UC1);
+		for(int r = 0; r < rows; ++r)
+			for(int c = 0; c < rows; ++c)
+				sloImage.at<std::uint8_t>(r, c) = static_cast<std::uint8_t>(r ^ c);
+		std::unique_ptr<OctData::SloImage> slo = std::make_unique<OctData::SloImage>();
+		slo->setImage(sloImage);
+		series.takeSloImage(std::move(slo));
+
+		const auto& layerTypes = OctData::Segmentationlines::getSegmentlineTypes();
+		const std::size_t numLayers = std::min(config.numLayers, layerTypes.size());
+
+		for(std::size_t i = 0; i < config.numBScans; ++i)
+		{
+			cv::Mat image(rows, cols, CV_8UC1);
+			for(int r = 0; r < rows; ++r)
+			{
+				std::uint8_t* row = image.ptr<std::uint8_t>(r);
+				for(int c = 0; c < cols; ++c)
+					row[c] = static_cast<std::uint8_t>(r + c + static_cast<int>(i));
+			}
+
+			OctData::BScan::Data data;
+			for(std::size_t l = 0; l < numLayers; ++l)
+			{
+				OctData::Segmentationlines::Segmentline& line = data.segmentationslines.getSegmentLine(layerTypes[l]);
+				line.resize(config.width);
+				for(std::size_t c = 0; c < config.width; ++c)
+					line[c] = static_cast<double>(config.height)*static_cast<double>(l + 1)/static_cast<double>(numLayers + 1) + static_cast<double>(c % 16)/8.;
+			}
+
+			series.addBScan(std::make_shared<OctData::BScan>(image, data));
+		}
+
+		return oct;
+	}
+
+	mxArray* createOptions(OptionList fields)
+	{
+		mxArray* options = mxCreateStructMatrix(1, 1, 0, nullptr);
+		for(const std::pair<const char*, const char*>& field : fields)
+		{
+			char* end = nullptr;
+			const double number = std::strtod(field.second, &end);
+			if(end != field.second && *end == '\0')
+				mxSetField(options, 0, field.first, mxCreateDoubleScalar(number));
+			else
+				mxSetField(options, 0, field.first, mxCreateString(field.second));
+		}
+		return options;
+	}
+
+	std::uint64_t getNumNew()
+	{
+		return numNew;
+	}
+
+	std::uint64_t getPeakMemory()
+	{
+		return getPeakResidentMemory();
+	}
+
+	void printHeader()
+	{
+		std::printf("%-56s %12s %12s %16s %16s %14s\n", "Benchmark", "Time [ms]", "MB/s", "mxArrays/B-scan", "allocs/B-scan", "peak RSS [MB]");
+		std::printf("%s\n", std::string(131, '-').c_str());
+	}
+
+	void printResult(const Config& config, const std::string& name, double seconds, const MexStub::Statistics& stat, std::uint64_t numNew)
+	{
+		const double numBScans = config.numBScans > 0 ? static_cast<double>(config.numBScans) : 1.;
+		const double mbPerSec  = seconds > 0 ? static_cast<double>(config.getDataBytes())/seconds/1e6 : 0.;
+		std::printf("%-56s %12.3f %12.1f %16.2f %16.2f %14.1f\n"
+		          , name.c_str()
+		          , seconds*1e3
+		          , mbPerSec
+		          , static_cast<double>(stat.arrays)/numBScans
+		          , static_cast<double>(stat.mallocs + numNew)/numBScans
+		          , static_cast<double>(getPeakMemory())/1e6);
+	}
+}
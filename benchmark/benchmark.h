@@ -0,0 +1,116 @@
+/*
+ * Copyright (c) 2018 Kay Gawlik <kaydev@amarunet.de> <kay.gawlik@beuth-hochschule.de> <kay.gawlik@charite.de>
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <initializer_list>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include <mex.h>
+
+namespace OctData { class OCT; }
+
+
+/*
+ * Minimal benchmark harness for the conversion code with the mex stub (mexstub/), output in the style of Google Benchmark:
+ * time per iteration, throughput of the image and segmentation data and the allocations per B-scan
+ * (mxCreate* calls, mxMalloc / mxCalloc and operator new calls).
+ */
+namespace Benchmark
+{
+	struct Config
+	{
+		std::size_t numBScans   = 128;
+		std::size_t width       = 512; // A-scans per B-scan
+		std::size_t height      = 496; // pixels per A-scan
+		std::size_t numLayers   = 3;   // filled segmentation lines per B-scan
+		std::size_t repetitions = 5;
+		std::string filter;            // run only the benchmarks containing this string
+
+		// image and segmentation bytes of the synthetic volume
+		std::uint64_t getDataBytes() const;
+	};
+
+	// --bscans=N --width=N --height=N --layers=N --repetitions=N --filter=text
+	Config parseArguments(int argc, char* argv[]);
+
+	// one patient / study / series with numBScans 8 bit B-scans, numLayers segmentation lines and a SLO image
+	std::unique_ptr<OctData::OCT> createSyntheticOct(const Config& config);
+
+	typedef std::initializer_list<std::pair<const char*, const char*>> OptionList;
+
+	// options struct, numbers as double scalars, other values as strings, e.g. createOptions({{"numThreads", "0"}, {"segmentationType", "int16"}})
+	mxArray* createOptions(OptionList fields);
+
+	std::uint64_t getNumNew();
+
+	// peak resident memory of the benchmark process, compare single benchmarks with --filter
+	std::uint64_t getPeakMemory();
+
+	void printHeader();
+	void printResult(const Config& config, const std::string& name, double seconds, const MexStub::Statistics& stat, std::uint64_t numNew);
+
+	// func(setup()) is called config.repetitions times, setup() and the release of the result are not measured
+	template<typename Setup, typename Func>
+	void run(const Config& config, const std::string& name, Setup&& setup, Func&& func)
+	{
+		if(!config.filter.empty() && name.find(config.filter) == std::string::npos)
+			return;
+
+		func(setup()); // warm up (thread creation, first touch of the memory)
+
+		double seconds = 0;
+		MexStub::Statistics stat;
+		std::uint64_t numNew = 0;
+		for(std::size_t i = 0; i < config.repetitions; ++i)
+		{
+			auto input = setup();
+
+			MexStub::resetStatistics();
+			const std::uint64_t newStart = getNumNew();
+			const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+			auto result = func(std::move(input));
+
+			const std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+			numNew  += getNumNew() - newStart;
+			seconds += std::chrono::duration<double>(end - start).count();
+
+			const MexStub::Statistics runStat = MexStub::getStatistics();
+			stat.arrays    += runStat.arrays;
+			stat.dataBytes += runStat.dataBytes;
+			stat.mallocs   += runStat.mallocs;
+		}
+
+		const std::uint64_t reps = config.repetitions > 0 ? config.repetitions : 1;
+		stat.arrays    /= reps;
+		stat.dataBytes /= reps;
+		stat.mallocs   /= reps;
+		printResult(config, name, seconds/static_cast<double>(reps), stat, numNew/reps);
+	}
+
+	// func() is called config.repetitions times, its result is released after the time measurement
+	template<typename Func>
+	void run(const Config& config, const std::string& name, Func&& func)
+	{
+		run(config, name, []() { return 0; }, [&func](int) { return func(); });
+	}
+}
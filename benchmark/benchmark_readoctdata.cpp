@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2018 Kay Gawlik <kaydev@amarunet.de> <kay.gawlik@beuth-hochschule.de> <kay.gawlik@charite.de>
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "benchmark.h"
+
+#include <octdata/datastruct/oct.h>
+
+#include <cstdio>
+#include <cstdlib>
+
+
+// readoctdata.cpp
+mxArray* convertOctData(std::shared_ptr<const OctData::OCT> oct, const mxArray* mxOptions);
+
+namespace
+{
+	typedef std::unique_ptr<mxArray, decltype(&mxDestroyArray)> MxArrayPtr;
+
+	void runConvert(const Benchmark::Config& config, const std::shared_ptr<const OctData::OCT>& oct, const std::string& name, Benchmark::OptionList options)
+	{
+		MxArrayPtr mxOptions(Benchmark::createOptions(options), &mxDestroyArray);
+		Benchmark::run(config, "readoctdata/" + name, [&]() { return MxArrayPtr(convertOctData(oct, mxOptions.get()), &mxDestroyArray); });
+	}
+
+	// the conversion gets the only reference to a new OCT (as readoctdata(filename) without cache), so releaseDecoded can drop the B-scans
+	void runConvertOwned(const Benchmark::Config& config, const std::string& name, Benchmark::OptionList options)
+	{
+		MxArrayPtr mxOptions(Benchmark::createOptions(options), &mxDestroyArray);
+		Benchmark::run(config, "readoctdata/owned/" + name
+		             , [&]() { return std::shared_ptr<const OctData::OCT>(Benchmark::createSyntheticOct(config)); }
+		             , [&](std::shared_ptr<const OctData::OCT> oct) { return MxArrayPtr(convertOctData(std::move(oct), mxOptions.get()), &mxDestroyArray); });
+	}
+}
+
+
+int main(int argc, char* argv[])
+{
+	const Benchmark::Config config = Benchmark::parseArguments(argc, argv);
+	const std::shared_ptr<const OctData::OCT> oct = Benchmark::createSyntheticOct(config);
+
+	std::printf("%zu B-scans %zu x %zu, %zu segmentation lines\n\n", config.numBScans, config.height, config.width, config.numLayers);
+	Benchmark::printHeader();
+
+	try
+	{
+		runConvert(config, oct, "default"                                    , {});
+		runConvert(config, oct, "numThreads:0"                               , {{"numThreads", "0"}});
+		runConvert(config, oct, "bscanVolume"                                , {{"bscanVolume", "1"}});
+		runConvert(config, oct, "bscanVolume/numThreads:0"                   , {{"bscanVolume", "1"}, {"numThreads", "0"}});
+		runConvert(config, oct, "bscanVolume/bscanTable/segmentationArray"   , {{"bscanVolume", "1"}, {"bscanTable", "1"}, {"segmentationArray", "1"}});
+		runConvert(config, oct, "segmentationArray/segmentationType:int16"   , {{"bscanVolume", "1"}, {"segmentationArray", "1"}, {"segmentationType", "int16"}});
+		runConvert(config, oct, "metadataOnly"                               , {{"metadataOnly", "1"}});
+		runConvertOwned(config, "default"                                    , {});
+		runConvertOwned(config, "releaseDecoded"                             , {{"releaseDecoded", "1"}});
+		runConvertOwned(config, "bscanVolume"                                , {{"bscanVolume", "1"}});
+		runConvertOwned(config, "releaseDecoded/bscanVolume"                 , {{"releaseDecoded", "1"}, {"bscanVolume", "1"}});
+	}
+	catch(const MexStub::Error& e)
+	{
+		std::fprintf(stderr, "%s: %s\n", e.id().c_str(), e.what());
+		return EXIT_FAILURE;
+	}
+
+	MexStub::unloadModule();
+	return EXIT_SUCCESS;
+}
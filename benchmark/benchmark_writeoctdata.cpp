@@ -0,0 +1,148 @@
+/*
+ * Copyright (c) 2018 Kay Gawlik <kaydev@amarunet.de> <kay.gawlik@beuth-hochschule.de> <kay.gawlik@charite.de>
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "benchmark.h"
+
+#include <octdata/datastruct/oct.h>
+#include <octdata/datastruct/segmentationlines.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+
+// writeoctdata.cpp
+void convertMatlabData(const mxArray* data, const mxArray* mxOptions, OctData::OCT& oct);
+
+namespace
+{
+	typedef std::unique_ptr<mxArray, decltype(&mxDestroyArray)> MxArrayPtr;
+
+	enum class ImageLayout { BScans, Volume, VolumeTransposed };
+
+	std::uint8_t getPixel(std::size_t bscan, std::size_t row, std::size_t col)
+	{
+		return static_cast<std::uint8_t>(row + col + bscan);
+	}
+
+	mxArray* createSegmentation(const Benchmark::Config& config)
+	{
+		const auto& layerTypes = OctData::Segmentationlines::getSegmentlineTypes();
+		const std::size_t numLayers = std::min(config.numLayers, layerTypes.size());
+
+		mxArray* segmentation = mxCreateStructMatrix(1, 1, 0, nullptr);
+		for(std::size_t l = 0; l < numLayers; ++l)
+		{
+			mxArray* line = mxCreateNumericMatrix(1, config.width, mxDOUBLE_CLASS, mxREAL);
+			double* data = static_cast<double*>(mxGetData(line));
+			for(std::size_t c = 0; c < config.width; ++c)
+				data[c] = static_cast<double>(config.height)*static_cast<double>(l + 1)/static_cast<double>(numLayers + 1) + static_cast<double>(c % 16)/8.;
+			mxSetField(segmentation, 0, OctData::Segmentationlines::getSegmentlineName(layerTypes[l]), line);
+		}
+		return segmentation;
+	}
+
+	// structure as returned by readoctdata for the layout, one patient / study / series
+	mxArray* createMatlabData(const Benchmark::Config& config, ImageLayout layout)
+	{
+		const std::size_t rows = config.height;
+		const std::size_t cols = config.width;
+
+		mxArray* bscans = mxCreateCellMatrix(1, config.numBScans);
+		for(std::size_t i = 0; i < config.numBScans; ++i)
+		{
+			mxArray* bscan = mxCreateStructMatrix(1, 1, 0, nullptr);
+			if(layout == ImageLayout::BScans)
+			{
+				mxArray* image = mxCreateNumericMatrix(rows, cols, mxUINT8_CLASS, mxREAL);
+				std::uint8_t* data = static_cast<std::uint8_t*>(mxGetData(image));
+				for(std::size_t c = 0; c < cols; ++c)
+					for(std::size_t r = 0; r < rows; ++r)
+						data[r + c*rows] = getPixel(i, r, c);
+				mxSetField(bscan, 0, "image", image);
+			}
+			mxSetField(bscan, 0, "segmentation", createSegmentation(config));
+			mxSetCell(bscans, i, bscan);
+		}
+
+		mxArray* series = mxCreateStructMatrix(1, 1, 0, nullptr);
+		mxSetField(series, 0, "bscans", bscans);
+
+		if(layout != ImageLayout::BScans)
+		{
+			const bool transposed = layout == ImageLayout::VolumeTransposed;
+			const mwSize dims[] = { transposed ? cols : rows, transposed ? rows : cols, config.numBScans };
+			mxArray* volume = mxCreateNumericArray(3, dims, mxUINT8_CLASS, mxREAL);
+			std::uint8_t* data = static_cast<std::uint8_t*>(mxGetData(volume));
+			for(std::size_t i = 0; i < config.numBScans; ++i)
+				for(std::size_t c = 0; c < cols; ++c)
+					for(std::size_t r = 0; r < rows; ++r)
+						data[(transposed ? c + r*cols : r + c*rows) + i*rows*cols] = getPixel(i, r, c);
+			mxSetField(series, 0, "volume", volume);
+		}
+
+		mxArray* study = mxCreateStructMatrix(1, 1, 0, nullptr);
+		mxSetField(study, 0, "Series_1", series);
+		mxArray* patient = mxCreateStructMatrix(1, 1, 0, nullptr);
+		mxSetField(patient, 0, "Study_1", study);
+		mxArray* oct = mxCreateStructMatrix(1, 1, 0, nullptr);
+		mxSetField(oct, 0, "Patient_1", patient);
+		return oct;
+	}
+
+	void runConvert(const Benchmark::Config& config, const mxArray* data, const std::string& name, Benchmark::OptionList options)
+	{
+		MxArrayPtr mxOptions(Benchmark::createOptions(options), &mxDestroyArray);
+		Benchmark::run(config, "writeoctdata/" + name, [&]()
+			{
+				std::unique_ptr<OctData::OCT> oct = std::make_unique<OctData::OCT>();
+				convertMatlabData(data, mxOptions.get(), *oct);
+				return oct;
+			});
+	}
+}
+
+
+int main(int argc, char* argv[])
+{
+	const Benchmark::Config config = Benchmark::parseArguments(argc, argv);
+
+	const MxArrayPtr bscans          (createMatlabData(config, ImageLayout::BScans          ), &mxDestroyArray);
+	const MxArrayPtr volume          (createMatlabData(config, ImageLayout::Volume          ), &mxDestroyArray);
+	const MxArrayPtr volumeTransposed(createMatlabData(config, ImageLayout::VolumeTransposed), &mxDestroyArray);
+
+	std::printf("%zu B-scans %zu x %zu, %zu segmentation lines\n\n", config.numBScans, config.height, config.width, config.numLayers);
+	Benchmark::printHeader();
+
+	try
+	{
+		runConvert(config, bscans.get()          , "bscans"                             , {});
+		runConvert(config, bscans.get()          , "bscans/numThreads:0"                , {{"numThreads", "0"}});
+		runConvert(config, volume.get()          , "bscanVolume"                        , {});
+		runConvert(config, volume.get()          , "bscanVolume/numThreads:0"           , {{"numThreads", "0"}});
+		runConvert(config, volumeTransposed.get(), "bscanVolume/imagesTransposed"       , {{"imagesTransposed", "1"}});
+	}
+	catch(const MexStub::Error& e)
+	{
+		std::fprintf(stderr, "%s: %s\n", e.id().c_str(), e.what());
+		return EXIT_FAILURE;
+	}
+
+	MexStub::unloadModule();
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,178 @@
+/*
+ * Copyright (c) 2018 Kay Gawlik <kaydev@amarunet.de> <kay.gawlik@beuth-hochschule.de> <kay.gawlik@charite.de>
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "matlab_helper.h"
+#include "mex.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#ifdef _WIN32
+	#ifndef NOMINMAX
+		#define NOMINMAX
+	#endif
+	#include <windows.h>
+	#include <psapi.h>
+	#ifdef _MSC_VER
+		#pragma comment(lib, "psapi.lib")
+	#endif
+#else
+	#include <sys/resource.h>
+#endif
+
+
+// peak resident memory of the process (matlab) in bytes, 0 if unknown
+inline std::uint64_t getPeakResidentMemory()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if(GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		return counters.PeakWorkingSetSize;
+	return 0;
+#else
+	rusage usage;
+	if(getrusage(RUSAGE_SELF, &usage) != 0)
+		return 0;
+	#ifdef __APPLE__
+	return static_cast<std::uint64_t>(usage.ru_maxrss);      // bytes
+	#else
+	return static_cast<std::uint64_t>(usage.ru_maxrss)*1024; // kilobytes
+	#endif
+#endif
+}
+
+// number of arrays and bytes of the numeric, char and logical data in the tree of matlabMat
+inline void countMxArrays(const mxArray* matlabMat, std::uint64_t& numArrays, std::uint64_t& numBytes)
+{
+	if(!matlabMat)
+		return;
+
+	++numArrays;
+	const std::size_t numel = mxGetNumberOfElements(matlabMat);
+	if(mxIsStruct(matlabMat))
+	{
+		const int numFields = mxGetNumberOfFields(matlabMat);
+		for(std::size_t i = 0; i < numel; ++i)
+			for(int field = 0; field < numFields; ++field)
+				countMxArrays(mxGetFieldByNumber(matlabMat, static_cast<mwIndex>(i), field), numArrays, numBytes);
+	}
+	else if(mxIsCell(matlabMat))
+	{
+		for(std::size_t i = 0; i < numel; ++i)
+			countMxArrays(mxGetCell(matlabMat, static_cast<mwIndex>(i)), numArrays, numBytes);
+	}
+	else
+		numBytes += numel*mxGetElementSize(matlabMat);
+}
+
+
+/*
+ * wall time per phase of one readoctdata / writeoctdata call, returned as struct by getMxArray().
+ * Phases can be nested (the times are inclusive), a phase called several times is summed up.
+ * Only for the matlab thread, the timers are not thread safe.
+ */
+class CallStatistics
+{
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	// adds the wall time of its scope to the phase, does nothing without statistics
+	class Timer
+	{
+		CallStatistics*   statistics;
+		const char*       phase;
+		Clock::time_point start;
+	public:
+		Timer(CallStatistics* statistics, const char* phase) : statistics(statistics), phase(phase)
+		{
+			if(statistics)
+				start = Clock::now();
+		}
+
+		~Timer()
+		{
+			if(statistics)
+				statistics->addTime(phase, Clock::now() - start);
+		}
+
+		Timer(const Timer&) = delete;
+		Timer& operator=(const Timer&) = delete;
+	};
+
+	void addTime(const char* phase, Clock::duration time)
+	{
+		for(Phase& p : phases)
+		{
+			if(std::strcmp(p.name, phase) == 0)
+			{
+				p.time += time;
+				++p.calls;
+				return;
+			}
+		}
+		phases.push_back(Phase{phase, time, 1});
+	}
+
+	// fields time and calls (one field per phase), mxArrays and bytes of data (the converted matlab structure) and peakMemory
+	mxArray* getMxArray(const mxArray* data) const
+	{
+		std::uint64_t numArrays = 0;
+		std::uint64_t numBytes  = 0;
+		countMxArrays(data, numArrays, numBytes);
+
+		ParameterToOptions pto;
+		{
+			ParameterToOptions time = pto.subSet("time");
+			for(const Phase& phase : phases)
+			{
+				double seconds = std::chrono::duration<double>(phase.time).count();
+				time(phase.name, seconds);
+			}
+		}
+		{
+			ParameterToOptions calls = pto.subSet("calls");
+			for(const Phase& phase : phases)
+			{
+				double numCalls = static_cast<double>(phase.calls);
+				calls(phase.name, numCalls);
+			}
+		}
+
+		double mxArrays   = static_cast<double>(numArrays);
+		double bytes      = static_cast<double>(numBytes);
+		double peakMemory = static_cast<double>(getPeakResidentMemory());
+		pto("mxArrays"  , mxArrays  );
+		pto("bytes"     , bytes     );
+		pto("peakMemory", peakMemory);
+
+		return pto.getMxOptions();
+	}
+
+private:
+	struct Phase
+	{
+		const char*     name; // string literal
+		Clock::duration time;
+		std::uint64_t   calls;
+	};
+
+	std::vector<Phase> phases; // in the order of the first call
+};
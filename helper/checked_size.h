@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2018 Kay Gawlik <kaydev@amarunet.de> <kay.gawlik@beuth-hochschule.de> <kay.gawlik@charite.de>
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <cstddef>
+#include <climits>
+#include <limits>
+
+#include "mex.h"
+
+
+/*
+ * Sizes and offsets of the conversion are std::size_t / mwSize (64 bit), a stitched wide field scan or a volume stack
+ * can have more than 2^31 elements. Where a size has to fit a smaller type (opencv matrices have int rows and cols)
+ * or a product could overflow, these functions report the failure instead of truncating silently.
+ * They do not use the mex API (the converters also run in worker threads), invalid input is rejected with
+ * mexErrMsgIdAndTxt by the callers on the matlab thread (e.g. checkImageNode in writeoctdata.cpp).
+ */
+namespace CheckedSize
+{
+	// false on overflow
+	inline bool mul(std::size_t a, std::size_t b, std::size_t& result)
+	{
+		if(a != 0 && b > std::numeric_limits<std::size_t>::max()/a)
+			return false;
+		result = a*b;
+		return true;
+	}
+
+	// number of elements of a dims array, false on overflow
+	inline bool numElements(std::size_t numDims, const mwSize* dims, std::size_t& result)
+	{
+		std::size_t numel = 1;
+		for(std::size_t i = 0; i < numDims; ++i)
+			if(!mul(numel, static_cast<std::size_t>(dims[i]), numel))
+				return false;
+		result = numel;
+		return true;
+	}
+
+	// rows, cols and channels of an opencv matrix, false if value exceeds int
+	inline bool toInt(std::size_t value, int& result)
+	{
+		if(value > static_cast<std::size_t>(INT_MAX))
+			return false;
+		result = static_cast<int>(value);
+		return true;
+	}
+}
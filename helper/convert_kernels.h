@@ -0,0 +1,196 @@
+/*
+ * Copyright (c) 2018 Kay Gawlik <kaydev@amarunet.de> <kay.gawlik@beuth-hochschule.de> <kay.gawlik@charite.de>
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#define OCTDATA4MATLAB_SSE2
+	#include <emmintrin.h>
+#endif
+
+
+/*
+ * Value conversion kernels for the segmentation lines: out[i] = (in[i] - offset)*scale
+ *
+ * int16 values are rounded (current rounding mode) and saturated to [-32767, 32767], the value -32768 marks a missing value:
+ * NaN (and values outside of the int32 range) are converted to -32768 and -32768 is converted back to NaN.
+ * A valid value never becomes -32768.
+ * The scalar code gives the same results as the SSE2 code.
+ */
+namespace ConvertKernel
+{
+	constexpr std::int16_t int16Missing = std::numeric_limits<std::int16_t>::min();
+	constexpr double       int16DefaultScale = 16; // default of the readoctdata option and the series field segmentationScale
+
+	inline std::int16_t toInt16(double value)
+	{
+		// as _mm_cvtpd_epi32 (int32 min for NaN and out of range) + _mm_packs_epi32 + the clamp in convert()
+		const double rounded = std::nearbyint(value);
+		if(!(rounded > -2147483648.0 && rounded < 2147483648.0))
+			return int16Missing;
+		return static_cast<std::int16_t>(std::min(std::max(rounded, -32767.0), 32767.0));
+	}
+
+	inline double fromInt16(std::int16_t value, double offset, double scale)
+	{
+		if(value == int16Missing)
+			return std::numeric_limits<double>::quiet_NaN();
+		return (value - offset)*scale;
+	}
+
+
+	inline void convert(const double* in, double* out, std::size_t size, double offset, double scale)
+	{
+		std::size_t i = 0;
+#ifdef OCTDATA4MATLAB_SSE2
+		const __m128d vOffset = _mm_set1_pd(offset);
+		const __m128d vScale  = _mm_set1_pd(scale );
+		for(; i + 2 <= size; i += 2)
+			_mm_storeu_pd(out + i, _mm_mul_pd(_mm_sub_pd(_mm_loadu_pd(in + i), vOffset), vScale));
+#endif
+		for(; i < size; ++i)
+			out[i] = (in[i] - offset)*scale;
+	}
+
+	inline void convert(const double* in, float* out, std::size_t size, double offset, double scale)
+	{
+		std::size_t i = 0;
+#ifdef OCTDATA4MATLAB_SSE2
+		const __m128d vOffset = _mm_set1_pd(offset);
+		const __m128d vScale  = _mm_set1_pd(scale );
+		for(; i + 4 <= size; i += 4)
+		{
+			const __m128 lo = _mm_cvtpd_ps(_mm_mul_pd(_mm_sub_pd(_mm_loadu_pd(in + i    ), vOffset), vScale));
+			const __m128 hi = _mm_cvtpd_ps(_mm_mul_pd(_mm_sub_pd(_mm_loadu_pd(in + i + 2), vOffset), vScale));
+			_mm_storeu_ps(out + i, _mm_movelh_ps(lo, hi));
+		}
+#endif
+		for(; i < size; ++i)
+			out[i] = static_cast<float>((in[i] - offset)*scale);
+	}
+
+	inline void convert(const double* in, std::int16_t* out, std::size_t size, double offset, double scale)
+	{
+		std::size_t i = 0;
+#ifdef OCTDATA4MATLAB_SSE2
+		const __m128d vOffset = _mm_set1_pd(offset);
+		const __m128d vScale  = _mm_set1_pd(scale );
+		const __m128i vInvalid = _mm_set1_epi32(std::numeric_limits<std::int32_t>::min()); // _mm_cvtpd_epi32 of NaN and out of range
+		const __m128i vMin     = _mm_set1_epi16(-32767);
+		auto toInt32 = [&](std::size_t pos) { return _mm_cvtpd_epi32(_mm_mul_pd(_mm_sub_pd(_mm_loadu_pd(in + pos), vOffset), vScale)); };
+		for(; i + 8 <= size; i += 8)
+		{
+			const __m128i lo      = _mm_unpacklo_epi64(toInt32(i    ), toInt32(i + 2));
+			const __m128i hi      = _mm_unpacklo_epi64(toInt32(i + 4), toInt32(i + 6));
+			const __m128i missing = _mm_packs_epi32(_mm_cmpeq_epi32(lo, vInvalid), _mm_cmpeq_epi32(hi, vInvalid)); // 0 / -1 per value
+			const __m128i values  = _mm_max_epi16(_mm_packs_epi32(lo, hi), vMin);
+			const __m128i result  = _mm_or_si128(_mm_andnot_si128(missing, values), _mm_and_si128(missing, _mm_set1_epi16(int16Missing)));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), result);
+		}
+#endif
+		for(; i < size; ++i)
+			out[i] = toInt16((in[i] - offset)*scale);
+	}
+
+	inline void convert(const float* in, double* out, std::size_t size, double offset, double scale)
+	{
+		std::size_t i = 0;
+#ifdef OCTDATA4MATLAB_SSE2
+		const __m128d vOffset = _mm_set1_pd(offset);
+		const __m128d vScale  = _mm_set1_pd(scale );
+		for(; i + 4 <= size; i += 4)
+		{
+			const __m128 values = _mm_loadu_ps(in + i);
+			_mm_storeu_pd(out + i    , _mm_mul_pd(_mm_sub_pd(_mm_cvtps_pd(values                        ), vOffset), vScale));
+			_mm_storeu_pd(out + i + 2, _mm_mul_pd(_mm_sub_pd(_mm_cvtps_pd(_mm_movehl_ps(values, values)), vOffset), vScale));
+		}
+#endif
+		for(; i < size; ++i)
+			out[i] = (in[i] - offset)*scale;
+	}
+
+	inline void convert(const std::int16_t* in, double* out, std::size_t size, double offset, double scale)
+	{
+		std::size_t i = 0;
+#ifdef OCTDATA4MATLAB_SSE2
+		const __m128d vOffset  = _mm_set1_pd(offset);
+		const __m128d vScale   = _mm_set1_pd(scale );
+		const __m128d vMissing = _mm_set1_pd(int16Missing);
+		const __m128d vNaN     = _mm_set1_pd(std::numeric_limits<double>::quiet_NaN());
+		auto store = [&](double* dst, __m128i values32)
+		{
+			const __m128d values  = _mm_cvtepi32_pd(values32);
+			const __m128d missing = _mm_cmpeq_pd(values, vMissing);
+			const __m128d result  = _mm_mul_pd(_mm_sub_pd(values, vOffset), vScale);
+			_mm_storeu_pd(dst, _mm_or_pd(_mm_andnot_pd(missing, result), _mm_and_pd(missing, vNaN)));
+		};
+		for(; i + 8 <= size; i += 8)
+		{
+			const __m128i values = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+			const __m128i lo     = _mm_srai_epi32(_mm_unpacklo_epi16(values, values), 16); // sign extension
+			const __m128i hi     = _mm_srai_epi32(_mm_unpackhi_epi16(values, values), 16);
+			store(out + i    , lo);
+			store(out + i + 2, _mm_srli_si128(lo, 8));
+			store(out + i + 4, hi);
+			store(out + i + 6, _mm_srli_si128(hi, 8));
+		}
+#endif
+		for(; i < size; ++i)
+			out[i] = fromInt16(in[i], offset, scale);
+	}
+
+
+	// strided input and output (e.g. a layer of a layers x A-scans array), gathered in chunks for the kernels above
+	template<typename In, typename Out>
+	void convertStrided(const In* in, std::size_t inStride, Out* out, std::size_t outStride, std::size_t size, double offset, double scale)
+	{
+		if(inStride == 1 && outStride == 1)
+		{
+			convert(in, out, size, offset, scale);
+			return;
+		}
+
+		constexpr std::size_t chunkSize = 256;
+		In  inChunk [chunkSize];
+		Out outChunk[chunkSize];
+		for(std::size_t pos = 0; pos < size; pos += chunkSize)
+		{
+			const std::size_t n = std::min(chunkSize, size - pos);
+
+			const In* src = in + pos*inStride;
+			if(inStride != 1)
+			{
+				for(std::size_t i = 0; i < n; ++i)
+					inChunk[i] = src[i*inStride];
+				src = inChunk;
+			}
+
+			Out* dst = outStride == 1 ? out + pos : outChunk;
+			convert(src, dst, n, offset, scale);
+
+			if(outStride != 1)
+				for(std::size_t i = 0; i < n; ++i)
+					out[(pos + i)*outStride] = outChunk[i];
+		}
+	}
+}
@@ -19,8 +19,11 @@
 
 
 #include "matlab_types.h"
+#include "convert_kernels.h"
 #include "mex.h"
 
+#include <cmath>
+#include <cstdint>
 #include <vector>
 #include <tuple>
 #include<type_traits>
@@ -38,13 +41,13 @@ void transposeMatlabMatrix(mxArray* matlabMat)
 
 	if(mxGetClassID(matlabMat) != MatlabType<T>::classID)
 	{
-		mexPrintf("Transpose Matrix: Wrong ClassID: %d != %d\n", mxGetClassID(matlabMat), MatlabType<T>::classID);
+		mexPrintf("Transpose Matrix: Wrong ClassID: %d != %d\n", static_cast<int>(mxGetClassID(matlabMat)), static_cast<int>(MatlabType<T>::classID));
 		return;
 	}
 
 	if(mxGetNumberOfDimensions(matlabMat) != 2)
 	{
-		mexPrintf("Transpose Matrix: not 2D matrix : %d\n", mxGetNumberOfDimensions(matlabMat));
+		mexPrintf("Transpose Matrix: not 2D matrix : %llu\n", static_cast<unsigned long long>(mxGetNumberOfDimensions(matlabMat)));
 		return;
 	}
 
@@ -55,7 +58,7 @@ void transposeMatlabMatrix(mxArray* matlabMat)
 	if(m != 1 && n != 1)
 	{
 		const T* const dataSource = reinterpret_cast<T*>(mxGetData(matlabMat));
-		      T* const dataDest   = reinterpret_cast<T*>(mxCalloc(m*n, sizeof(T)));
+		      T* const dataDest   = reinterpret_cast<T*>(mxCalloc(static_cast<std::size_t>(m)*n, sizeof(T)));
 
 		const T* sourceIt = dataSource;
 
@@ -156,17 +159,17 @@ void copyVec2MatlabRow(const std::vector<T>& vec, mwSize row, mxArray* matlabMat
 
 	if(mxGetClassID(matlabMat) != MatlabType<T>::classID)
 	{
-		mexPrintf("Wrong ClassID: %d != %d\n", mxGetClassID(matlabMat), MatlabType<T>::classID);
+		mexPrintf("Wrong ClassID: %d != %d\n", static_cast<int>(mxGetClassID(matlabMat)), static_cast<int>(MatlabType<T>::classID));
 		return;
 	}
 
 	T* matlabPtr = reinterpret_cast<T*>(mxGetPr(matlabMat));
-	std::size_t cols = mxGetN(matlabMat);
-	std::size_t rows = mxGetM(matlabMat);
+	const mwSize cols = mxGetN(matlabMat);
+	const mwSize rows = mxGetM(matlabMat);
 
-	if(cols < vec.size())
+	if(cols < vec.size() || row >= rows)
 	{
-		mexPrintf("Matrix zu klein:: %d < %d\n", cols, vec.size());
+		mexPrintf("Matrix zu klein:: %llu x %llu, row %llu, %llu elements\n", static_cast<unsigned long long>(rows), static_cast<unsigned long long>(cols), static_cast<unsigned long long>(row), static_cast<unsigned long long>(vec.size()));
 		return;
 	}
 
@@ -179,7 +182,7 @@ void copyVec2MatlabRow(const std::vector<T>& vec, mwSize row, mxArray* matlabMat
 }
 
 template<typename T>
-void copyVec2MatlabCol(const std::vector<T>& vec, std::size_t col, mxArray* matlabMat)
+void copyVec2MatlabCol(const std::vector<T>& vec, mwSize col, mxArray* matlabMat)
 {
 	if(!matlabMat)
 	{
@@ -189,17 +192,17 @@ void copyVec2MatlabCol(const std::vector<T>& vec, std::size_t col, mxArray* matl
 
 	if(mxGetClassID(matlabMat) != MatlabType<T>::classID)
 	{
-		mexPrintf("Wrong ClassID: %d != %d\n", mxGetClassID(matlabMat), MatlabType<T>::classID);
+		mexPrintf("Wrong ClassID: %d != %d\n", static_cast<int>(mxGetClassID(matlabMat)), static_cast<int>(MatlabType<T>::classID));
 		return;
 	}
 
 	T* matlabPtr = reinterpret_cast<T*>(mxGetPr(matlabMat));
-	std::size_t cols = mxGetN(matlabMat);
-	std::size_t rows = mxGetM(matlabMat);
+	const mwSize cols = mxGetN(matlabMat);
+	const mwSize rows = mxGetM(matlabMat);
 
-	if(rows < vec.size())
+	if(rows < vec.size() || col >= cols)
 	{
-		mexPrintf("Matrix zu klein:: %d < %d\n", cols, vec.size());
+		mexPrintf("Matrix zu klein:: %llu x %llu, col %llu, %llu elements\n", static_cast<unsigned long long>(rows), static_cast<unsigned long long>(cols), static_cast<unsigned long long>(col), static_cast<unsigned long long>(vec.size()));
 		return;
 	}
 
@@ -228,12 +231,15 @@ template<typename MatType, typename T>
 void convertValue(std::vector<T>& ref, const mxArray* const matlabMat, const std::size_t /*eleNr*/ = 0)
 {
 	void* dataPtr = mxGetData(matlabMat);
-	const std::size_t size = mxGetM(matlabMat)*mxGetN(matlabMat);
+	const std::size_t size = mxGetNumberOfElements(matlabMat);
 	ref.resize(size);
 	const MatType* in = reinterpret_cast<const MatType*>(dataPtr);
 
-	for(std::size_t i = 0; i < size; ++i)
-		ref[i] = static_cast<T>(in[i]);
+	if constexpr(std::is_same<MatType, float>::value && std::is_same<T, double>::value)
+		ConvertKernel::convert(in, ref.data(), size, 0., 1.);
+	else
+		for(std::size_t i = 0; i < size; ++i)
+			ref[i] = static_cast<T>(in[i]);
 }
 
 
@@ -260,7 +266,7 @@ T getValueConvert(const mxArray* const matlabMat, const std::size_t eleNr = 0)
 		HANDLE_TYPE( int64_t);
 #undef HANDLE_TYPE
 		default:
-			mexPrintf("unhandled Type: %d", mxGetClassID(matlabMat));
+			mexPrintf("unhandled Type: %d", static_cast<int>(mxGetClassID(matlabMat)));
 	}
 
 	return T();
@@ -273,20 +279,37 @@ T getScalarConvert(const mxArray* matlabMat)
 }
 
 template<>
-std::string getScalarConvert(const mxArray* matlabMat)
+inline std::string getScalarConvert(const mxArray* matlabMat)
 {
-	if(!matlabMat && mxGetClassID(matlabMat) !=  MatlabType<char>::classID)
+	if(!matlabMat)
+		return std::string();
+
+	if(mxGetClassID(matlabMat) != MatlabType<char>::classID)
 	{
-		mexPrintf("get String: wrong class %d != %d", mxGetClassID(matlabMat), MatlabType<char>::classID);
+		mexPrintf("get String: wrong class %d != %d", static_cast<int>(mxGetClassID(matlabMat)), static_cast<int>(MatlabType<char>::classID));
 		return std::string();
 	}
 
 	const mxChar* fnPtr = reinterpret_cast<const mxChar*>(mxGetPr(matlabMat));
-	std::size_t fnLength = mxGetN(matlabMat);
+	const std::size_t fnLength = mxGetNumberOfElements(matlabMat);
 	std::string filename(fnPtr, fnPtr+fnLength);
 	return filename;
 }
 
+// handle of the command interfaces ('open', ...): a numeric scalar with a positive integer value, false otherwise (e.g. 1.5, -1, NaN)
+inline bool getHandle(const mxArray* mxHandle, std::uint64_t& handle)
+{
+	if(!mxHandle || !mxIsNumeric(mxHandle) || mxGetNumberOfElements(mxHandle) != 1)
+		return false;
+
+	const double value = getScalarConvert<double>(mxHandle);
+	if(!(value >= 1.) || value > 9007199254740992. || std::floor(value) != value) // up to 2^53, exact as double
+		return false;
+
+	handle = static_cast<std::uint64_t>(value);
+	return true;
+}
+
 template<typename T>
 inline T getConfigFromStruct(const mxArray* const mxConfig, const char* name, const T defaultValue)
 {
@@ -409,14 +432,14 @@ public:
 };
 
 template<>
-void ParameterToOptions::operator()(const std::string& name, const std::string& value)
+inline void ParameterToOptions::operator()(const std::string& name, const std::string& value)
 {
 	nameList.push_back(name);
 	valueList.emplace_back(mxCreateString(value.c_str()));
 }
 
 template<>
-void ParameterToOptions::operator()(const std::string& name, std::string& value)
+inline void ParameterToOptions::operator()(const std::string& name, std::string& value)
 {
 	nameList.push_back(name);
 	valueList.emplace_back(mxCreateString(value.c_str()));
@@ -0,0 +1,213 @@
+/*
+ * Copyright (c) 2018 Kay Gawlik <kaydev@amarunet.de> <kay.gawlik@beuth-hochschule.de> <kay.gawlik@charite.de>
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include <octdata/datastruct/oct.h>
+#include <octdata/datastruct/sloimage.h>
+#include <octdata/datastruct/bscan.h>
+
+
+inline std::size_t estimateMemory(const cv::Mat& image)
+{
+	return image.total()*image.elemSize();
+}
+
+template<typename S>
+std::size_t estimateMemory(const S& structure)
+{
+	std::size_t bytes = 0;
+	for(typename S::SubstructurePair const& subStructPair : structure)
+		bytes += estimateMemory(*subStructPair.second);
+	return bytes;
+}
+
+template<>
+inline std::size_t estimateMemory<OctData::Series>(const OctData::Series& series)
+{
+	std::size_t bytes = estimateMemory(series.getSloImage().getImage());
+	for(const std::shared_ptr<const OctData::BScan>& bscan : series.getBScans())
+	{
+		if(!bscan)
+			continue;
+
+		bytes += estimateMemory(bscan->getImage()) + estimateMemory(bscan->getAngioImage()) + sizeof(OctData::BScan);
+		for(OctData::Segmentationlines::SegmentlineType type : OctData::Segmentationlines::getSegmentlineTypes())
+			bytes += bscan->getSegmentLines().getSegmentLine(type).size()*sizeof(OctData::Segmentationlines::Segmentline::value_type);
+	}
+	return bytes;
+}
+
+
+/*
+ * LRU cache for decoded files, identified by path and read options.
+ * An entry is only valid while modification time and size of the file are unchanged.
+ */
+class OctDataCache
+{
+public:
+	typedef std::shared_ptr<const OctData::OCT> OctPtr;
+
+	struct FileState
+	{
+		std::int64_t   mtime = 0;
+		std::uintmax_t size  = 0;
+
+		bool operator==(const FileState& other) const { return mtime == other.mtime && size == other.size; }
+		bool operator!=(const FileState& other) const { return !(*this == other); }
+
+		static FileState fromFile(const std::string& path)
+		{
+			std::error_code ec;
+			FileState state;
+			state.mtime = static_cast<std::int64_t>(std::filesystem::last_write_time(path, ec).time_since_epoch().count());
+			if(std::filesystem::is_regular_file(path, ec))
+				state.size = std::filesystem::file_size(path, ec);
+			return state;
+		}
+	};
+
+private:
+	struct Entry
+	{
+		std::string key;
+		FileState   state;
+		OctPtr      oct;
+		std::size_t bytes;
+	};
+	typedef std::list<Entry> EntryList;
+
+	EntryList                                    entries; // most recently used first
+	std::map<std::string, EntryList::iterator>   index;
+
+	std::size_t   budget    = std::size_t(2) << 30;
+	std::size_t   usedBytes = 0;
+	std::uint64_t hits      = 0;
+	std::uint64_t misses    = 0;
+
+	mutable std::mutex mutex;
+
+	static std::string makeKey(const std::string& path, const std::string& options) { return path + '\n' + options; }
+
+	void erase(std::map<std::string, EntryList::iterator>::iterator it)
+	{
+		usedBytes -= it->second->bytes;
+		entries.erase(it->second);
+		index.erase(it);
+	}
+
+	void shrink(std::size_t maxBytes)
+	{
+		while(usedBytes > maxBytes && !entries.empty())
+			erase(index.find(entries.back().key));
+	}
+
+public:
+	OctPtr get(const std::string& path, const std::string& options, const FileState& state)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+
+		std::map<std::string, EntryList::iterator>::iterator it = index.find(makeKey(path, options));
+		if(it == index.end() || it->second->state != state)
+		{
+			if(it != index.end())
+				erase(it);
+			++misses;
+			return nullptr;
+		}
+
+		entries.splice(entries.begin(), entries, it->second);
+		++hits;
+		return it->second->oct;
+	}
+
+	void insert(const std::string& path, const std::string& options, const FileState& state, OctPtr oct)
+	{
+		const std::size_t bytes = estimateMemory(*oct);
+
+		std::lock_guard<std::mutex> lock(mutex);
+		if(bytes > budget)
+			return;
+
+		const std::string key = makeKey(path, options);
+		std::map<std::string, EntryList::iterator>::iterator it = index.find(key);
+		if(it != index.end())
+			erase(it);
+
+		shrink(budget - bytes);
+		entries.push_front(Entry{key, state, std::move(oct), bytes});
+		index[key] = entries.begin();
+		usedBytes += bytes;
+	}
+
+	void clear()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		entries.clear();
+		index.clear();
+		usedBytes = 0;
+	}
+
+	void setBudget(std::size_t bytes)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		budget = bytes;
+		shrink(budget);
+	}
+
+	bool empty() const
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return entries.empty();
+	}
+
+	std::size_t getBudget() const
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return budget;
+	}
+
+	std::size_t getUsedBytes() const
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return usedBytes;
+	}
+
+	template<typename T>
+	void getStatistics(T& getSet) const
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		std::uint64_t numEntries = entries.size();
+		std::uint64_t bytes      = usedBytes;
+		std::uint64_t maxBytes   = budget;
+		std::uint64_t numHits    = hits;
+		std::uint64_t numMisses  = misses;
+		getSet("entries", numEntries);
+		getSet("bytes"  , bytes     );
+		getSet("budget" , maxBytes  );
+		getSet("hits"   , numHits   );
+		getSet("misses" , numMisses );
+	}
+};
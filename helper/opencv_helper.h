@@ -20,70 +20,84 @@
 #include <opencv2/opencv.hpp>
 
 #include "matlab_types.h"
+#include "checked_size.h"
+#include "transpose_kernel.h"
 #include "mex.h"
 
 
+// number of elements left when only every decimation-th element is taken
+inline std::size_t decimatedSize(std::size_t size, std::size_t decimation)
+{
+	return (size + decimation - 1)/decimation;
+}
+
+// with decimation > 1 only every decimation-th row and column is copied
 template<typename T>
-void copyMatrixTranspose(const cv::Mat& cvMat, T* matlabPtr, std::size_t channel)
+void copyMatrixTranspose(const cv::Mat& cvMat, T* matlabPtr, std::size_t channel, std::size_t decimation = 1)
 {
-	const int sizeCols = cvMat.cols;
-	const int sizeRows = cvMat.rows;
-	const int channels = cvMat.channels();
+	if(cvMat.empty())
+		return;
 
-	for(int i = 0; i < sizeRows; ++i)
-	{
-		T* matlabLine = matlabPtr + i;
-		const T* ptr = cvMat.ptr<T>(i) + channel;
-		for(int j = 0; j < sizeCols; ++j)
-		{
-			*matlabLine = *ptr;
-			matlabLine += sizeRows;
-			ptr += channels;
-		}
-	}
+	const std::size_t sizeCols = decimatedSize(static_cast<std::size_t>(cvMat.cols), decimation);
+	const std::size_t sizeRows = decimatedSize(static_cast<std::size_t>(cvMat.rows), decimation);
+	const std::size_t channels = static_cast<std::size_t>(cvMat.channels());
+
+	// opencv row i is written to the matlab column elements i, i+sizeRows, ...
+	transposeCopy(cvMat.ptr<T>(0) + channel, cvMat.step1()*decimation, channels*decimation
+	            , matlabPtr                , sizeRows                 , 1
+	            , sizeRows, sizeCols);
 }
 
 template<typename T>
-void copyMatrix(const cv::Mat& cvMat, T* matlabPtr)
+void copyMatrix(const cv::Mat& cvMat, T* matlabPtr, std::size_t decimation = 1)
 {
 	if(!matlabPtr)
 		return;
 
-	const std::size_t sizeCols = cvMat.cols;
-	const std::size_t sizeRows = cvMat.rows;
-	const std::size_t channels = cvMat.channels();
+	const std::size_t sizeCols  = decimatedSize(static_cast<std::size_t>(cvMat.cols), decimation);
+	const std::size_t sizeRows  = decimatedSize(static_cast<std::size_t>(cvMat.rows), decimation);
+	const std::size_t channels  = static_cast<std::size_t>(cvMat.channels());
+	const std::size_t planeSize = sizeCols*sizeRows; // int rows x int cols, no overflow in 64 bit
 
 	// copy transpose matrix because opencv's structure is row based and matlab's structure is col based
-	if(channels == 3) // convert opencv bgr to rgb
+	if(channels == 3) // convert opencv bgr to rgb, all planes in one pass over the pixels
 	{
-		copyMatrixTranspose(cvMat, matlabPtr + 0*sizeCols*sizeRows, 2);
-		copyMatrixTranspose(cvMat, matlabPtr + 1*sizeCols*sizeRows, 1);
-		copyMatrixTranspose(cvMat, matlabPtr + 2*sizeCols*sizeRows, 0);
+		if(cvMat.empty())
+			return;
+
+		T* const planes[] = { matlabPtr + 2*planeSize, matlabPtr + 1*planeSize, matlabPtr + 0*planeSize };
+		deinterleaveTransposeCopy(cvMat.ptr<T>(0), cvMat.step1()*decimation, 3*decimation
+		                        , planes, sizeRows
+		                        , sizeRows, sizeCols);
 	}
 	else
 	{
 		for(std::size_t channel = 0; channel < channels; ++channel)
-			copyMatrixTranspose(cvMat, matlabPtr + channel*sizeCols*sizeRows, channel);
+			copyMatrixTranspose(cvMat, matlabPtr + channel*planeSize, channel, decimation);
 	}
 }
 
+template<typename T>
+mxArray* createMatrix(const cv::Mat& cvMat, std::size_t decimation = 1)
+{
+	const mwSize sizeCols = static_cast<mwSize>(decimatedSize(static_cast<std::size_t>(cvMat.cols), decimation));
+	const mwSize sizeRows = static_cast<mwSize>(decimatedSize(static_cast<std::size_t>(cvMat.rows), decimation));
+	const mwSize channels = static_cast<mwSize>(cvMat.channels());
+
+	if(channels == 1)
+		return mxCreateNumericMatrix(sizeRows, sizeCols, MatlabType<T>::classID, mxREAL);
+
+	mwSize dimsArray[] = {sizeRows, sizeCols, channels};
+	return mxCreateNumericArray(3, dimsArray, MatlabType<T>::classID, mxREAL);
+}
+
 template<typename T>
 void createCopyMatrix(const cv::Mat& cvMat, mxArray*& matlabMat)
 {
 	if(matlabMat)
 		return;
 
-	const mwSize sizeCols = static_cast<mwSize>(cvMat.cols      );
-	const mwSize sizeRows = static_cast<mwSize>(cvMat.rows      );
-	const mwSize channels = static_cast<mwSize>(cvMat.channels());
-
-	if(channels == 1)
-		matlabMat = mxCreateNumericMatrix(sizeRows, sizeCols, MatlabType<T>::classID, mxREAL);
-	else
-	{
-		mwSize dimsArray[] = {sizeRows, sizeCols, channels};
-		matlabMat = mxCreateNumericArray(3, dimsArray, MatlabType<T>::classID, mxREAL);
-	}
+	matlabMat = createMatrix<T>(cvMat);
 
 	if(!matlabMat)
 		return;
@@ -105,21 +119,17 @@ mxArray* convertMatrix(const cv::Mat& cvMat)
 template<typename T>
 void copyMatrixTranspose(const T* matlabPtr, cv::Mat& cvMat, std::size_t channel)
 {
-	const int sizeCols = cvMat.cols;
-	const int sizeRows = cvMat.rows;
-	const int channels = cvMat.channels();
+	if(cvMat.empty())
+		return;
 
-	for(int i = 0; i < sizeRows; ++i)
-	{
-		const T* matlabLine = matlabPtr + i;
-		T* ptr = cvMat.ptr<T>(i) + channel;
-		for(int j = 0; j < sizeCols; ++j)
-		{
-			*ptr = *matlabLine;
-			matlabLine += sizeRows;
-			ptr += channels;
-		}
-	}
+	const std::size_t sizeCols = static_cast<std::size_t>(cvMat.cols      );
+	const std::size_t sizeRows = static_cast<std::size_t>(cvMat.rows      );
+	const std::size_t channels = static_cast<std::size_t>(cvMat.channels());
+
+	// matlab column j is written to the opencv column j
+	transposeCopy(matlabPtr                , sizeRows     , 1
+	            , cvMat.ptr<T>(0) + channel, cvMat.step1(), channels
+	            , sizeCols, sizeRows);
 }
 
 template<typename T>
@@ -130,26 +140,35 @@ void copyMatrix(const mxArray* matlabMat, cv::Mat& cvMat)
 
 	if(mxGetClassID(matlabMat) != MatlabType<T>::classID)
 	{
-		mexPrintf("copyMatrix: Wrong ClassID: %d != %d\n", mxGetClassID(matlabMat), MatlabType<T>::classID);
+		mexPrintf("copyMatrix: Wrong ClassID: %d != %d\n", static_cast<int>(mxGetClassID(matlabMat)), static_cast<int>(MatlabType<T>::classID));
 		return;
 	}
 
-	const std::size_t sizeCols = cvMat.cols;
-	const std::size_t sizeRows = cvMat.rows;
-	const std::size_t channels = cvMat.channels();
+	const std::size_t sizeCols  = static_cast<std::size_t>(cvMat.cols);
+	const std::size_t sizeRows  = static_cast<std::size_t>(cvMat.rows);
+	const std::size_t channels  = static_cast<std::size_t>(cvMat.channels());
+	const std::size_t planeSize = sizeCols*sizeRows;
+
+	if(mxGetNumberOfElements(matlabMat) < planeSize*channels) // cvMat does not belong to matlabMat
+		return;
 
 	const T* matlabPtr = reinterpret_cast<const T*>(mxGetPr(matlabMat));
 	// copy transpose matrix because opencv's structure is row based and matlab's structure is col based
-	if(channels == 3) // convert opencv bgr to rgb
+	if(channels == 3) // convert rgb to opencv bgr, all planes in one pass over the pixels
 	{
-		copyMatrixTranspose(matlabPtr + 0*sizeCols*sizeRows, cvMat, 2);
-		copyMatrixTranspose(matlabPtr + 1*sizeCols*sizeRows, cvMat, 1);
-		copyMatrixTranspose(matlabPtr + 2*sizeCols*sizeRows, cvMat, 0);
+		if(cvMat.empty())
+			return;
+
+		// matlab column j is written to the opencv column j
+		const T* const planes[] = { matlabPtr + 2*planeSize, matlabPtr + 1*planeSize, matlabPtr + 0*planeSize };
+		interleaveTransposeCopy(planes, sizeRows
+		                      , cvMat.ptr<T>(0), cvMat.step1()
+		                      , sizeCols, sizeRows);
 	}
 	else
 	{
 		for(std::size_t channel = 0; channel < channels; ++channel)
-		copyMatrixTranspose(matlabPtr + channel*sizeCols*sizeRows, cvMat, channel);
+			copyMatrixTranspose(matlabPtr + channel*planeSize, cvMat, channel);
 	}
 }
 
@@ -166,9 +185,206 @@ cv::Mat convertMatrix(const mxArray* matlabMat)
 	if(numDims != 2 && numDims != 3)
 		return cv::Mat(); // TODO error message
 
-	int channels = numDims==3?static_cast<int>(dims[2]):1;
+	// beyond the opencv limits -> empty matrix (no mex error, also called in worker threads)
+	const std::size_t channels = numDims == 3 ? dims[2] : 1;
+	int rows = 0;
+	int cols = 0;
+	if(channels > CV_CN_MAX || !CheckedSize::toInt(dims[0], rows) || !CheckedSize::toInt(dims[1], cols))
+		return cv::Mat();
 
-	cv::Mat cvMat(static_cast<int>(dims[0]), static_cast<int>(dims[1]), CV_MAKETYPE(cv::DataType<uint8_t>::type, channels));
+	cv::Mat cvMat(rows, cols, CV_MAKETYPE(cv::DataType<T>::depth, static_cast<int>(channels)));
 	copyMatrix<T>(matlabMat, cvMat);
 	return cvMat;
 }
+
+
+template<typename T>
+cv::Mat convertVolumeSlice(const mxArray* matlabMat, std::size_t slice)
+{
+	if(!matlabMat)
+		return cv::Mat();
+
+	if(mxGetClassID(matlabMat) != MatlabType<T>::classID)
+	{
+		mexPrintf("convertVolumeSlice: Wrong ClassID: %d != %d\n", static_cast<int>(mxGetClassID(matlabMat)), static_cast<int>(MatlabType<T>::classID));
+		return cv::Mat();
+	}
+
+	const mwSize  numDims = mxGetNumberOfDimensions(matlabMat);
+	const mwSize* dims    = mxGetDimensions(matlabMat);
+
+	const std::size_t sizeRows  = dims[0];
+	const std::size_t sizeCols  = dims[1];
+	const std::size_t numSlices = numDims > 2 ? dims[2] : 1;
+
+	if(numDims > 3 || slice >= numSlices)
+		return cv::Mat();
+
+	int rows = 0;
+	int cols = 0;
+	if(!CheckedSize::toInt(sizeRows, rows) || !CheckedSize::toInt(sizeCols, cols))
+		return cv::Mat();
+
+	cv::Mat cvMat(rows, cols, cv::DataType<T>::depth);
+	const T* matlabPtr = reinterpret_cast<const T*>(mxGetData(matlabMat)) + slice*sizeRows*sizeCols; // below numel, no overflow
+	copyMatrixTranspose(matlabPtr, cvMat, 0);
+	return cvMat;
+}
+
+
+// call func(T()) with the element type T of the opencv depth / matlab class
+template<typename Func>
+bool callWithDepthType(int depth, Func&& func)
+{
+	switch(depth)
+	{
+#define HANDLE_TYPE(TYPE) case cv::DataType<TYPE>::depth: func(TYPE()); return true;
+		HANDLE_TYPE(uint8_t);
+		HANDLE_TYPE( int8_t);
+		HANDLE_TYPE(uint16_t);
+		HANDLE_TYPE( int16_t);
+		HANDLE_TYPE( int32_t);
+		HANDLE_TYPE(float);
+		HANDLE_TYPE(double);
+#undef HANDLE_TYPE
+		default:
+			mexPrintf("unhandled opencv depth: %d\n", depth);
+	}
+	return false;
+}
+
+template<typename Func>
+bool callWithClassType(mxClassID classID, Func&& func)
+{
+	switch(classID)
+	{
+#define HANDLE_TYPE(TYPE) case MatlabType<TYPE>::classID: func(TYPE()); return true;
+		HANDLE_TYPE(uint8_t);
+		HANDLE_TYPE( int8_t);
+		HANDLE_TYPE(uint16_t);
+		HANDLE_TYPE( int16_t);
+		HANDLE_TYPE( int32_t);
+		HANDLE_TYPE(float);
+		HANDLE_TYPE(double);
+#undef HANDLE_TYPE
+		default:
+			mexPrintf("unhandled matlab class: %d\n", static_cast<int>(classID));
+	}
+	return false;
+}
+
+
+// native element type: opencv depth <-> matlab class
+inline mxArray* createMatrix(const cv::Mat& cvMat, std::size_t decimation = 1)
+{
+	mxArray* matlabMat = nullptr;
+	callWithDepthType(cvMat.depth(), [&](auto type) { matlabMat = createMatrix<decltype(type)>(cvMat, decimation); });
+	return matlabMat;
+}
+
+// matlabPtr has to point to the data of a matrix created by createMatrix(cvMat, decimation) or to a slice of a volume from createVolume()
+inline void copyMatrix(const cv::Mat& cvMat, void* matlabPtr, std::size_t decimation = 1)
+{
+	callWithDepthType(cvMat.depth(), [&](auto type) { using T = decltype(type); copyMatrix<T>(cvMat, reinterpret_cast<T*>(matlabPtr), decimation); });
+}
+
+inline mxArray* convertMatrix(const cv::Mat& cvMat)
+{
+	mxArray* matlabMat = nullptr;
+	callWithDepthType(cvMat.depth(), [&](auto type) { matlabMat = convertMatrix<decltype(type)>(cvMat); });
+	return matlabMat;
+}
+
+inline cv::Mat convertMatrix(const mxArray* matlabMat)
+{
+	cv::Mat cvMat;
+	if(matlabMat)
+		callWithClassType(mxGetClassID(matlabMat), [&](auto type) { cvMat = convertMatrix<decltype(type)>(matlabMat); });
+	return cvMat;
+}
+
+inline cv::Mat convertVolumeSlice(const mxArray* matlabMat, std::size_t slice)
+{
+	cv::Mat cvMat;
+	if(matlabMat)
+		callWithClassType(mxGetClassID(matlabMat), [&](auto type) { cvMat = convertVolumeSlice<decltype(type)>(matlabMat, slice); });
+	return cvMat;
+}
+
+// rows x cols x numSlices array for single channel images of the size and type of cvMat, nullptr if the size overflows
+inline mxArray* createVolume(const cv::Mat& cvMat, mwSize numSlices, std::size_t decimation = 1)
+{
+	mxArray* matlabMat = nullptr;
+	callWithDepthType(cvMat.depth(), [&](auto type)
+		{
+			mwSize dimsArray[] = { static_cast<mwSize>(decimatedSize(static_cast<std::size_t>(cvMat.rows), decimation))
+			                     , static_cast<mwSize>(decimatedSize(static_cast<std::size_t>(cvMat.cols), decimation))
+			                     , numSlices };
+			std::size_t numElements = 0;
+			std::size_t bytes       = 0;
+			if(!CheckedSize::numElements(3, dimsArray, numElements) || !CheckedSize::mul(numElements, sizeof(decltype(type)), bytes))
+				return; // nullptr
+			matlabMat = mxCreateNumericArray(3, dimsArray, MatlabType<decltype(type)>::classID, mxREAL);
+		});
+	return matlabMat;
+}
+
+
+inline int getDepth(mxClassID classID)
+{
+	int depth = -1;
+	callWithClassType(classID, [&](auto type) { depth = cv::DataType<decltype(type)>::depth; });
+	return depth;
+}
+
+// a matlab width x height array has the memory layout of an opencv height x width matrix:
+// single channel header over the slice of a width x height x N array, without copy (the matlab array has to outlive it)
+inline cv::Mat wrapTransposedVolumeSlice(const mxArray* matlabMat, std::size_t slice)
+{
+	if(!matlabMat)
+		return cv::Mat();
+
+	const int depth = getDepth(mxGetClassID(matlabMat));
+	if(depth < 0)
+		return cv::Mat();
+
+	const mwSize  numDims = mxGetNumberOfDimensions(matlabMat);
+	const mwSize* dims    = mxGetDimensions(matlabMat);
+
+	const std::size_t sizeCols  = dims[0];
+	const std::size_t sizeRows  = dims[1];
+	const std::size_t numSlices = numDims > 2 ? dims[2] : 1;
+
+	if(numDims > 3 || slice >= numSlices)
+		return cv::Mat();
+
+	int rows = 0;
+	int cols = 0;
+	if(!CheckedSize::toInt(sizeRows, rows) || !CheckedSize::toInt(sizeCols, cols))
+		return cv::Mat();
+
+	char* data = static_cast<char*>(mxGetData(matlabMat)) + slice*sizeRows*sizeCols*mxGetElementSize(matlabMat);
+	return cv::Mat(rows, cols, depth, data);
+}
+
+// width x height (x channels) array, single channel without copy, the planes of more channels are merged (rgb -> bgr)
+inline cv::Mat wrapTransposedMatrix(const mxArray* matlabMat)
+{
+	if(!matlabMat)
+		return cv::Mat();
+
+	const mwSize numDims = mxGetNumberOfDimensions(matlabMat);
+	const std::size_t channels = numDims == 3 ? mxGetDimensions(matlabMat)[2] : 1;
+	if(channels == 1)
+		return wrapTransposedVolumeSlice(matlabMat, 0);
+
+	std::vector<cv::Mat> planes;
+	for(std::size_t channel = 0; channel < channels; ++channel)
+		planes.push_back(wrapTransposedVolumeSlice(matlabMat, channel));
+	if(channels == 3)
+		std::swap(planes[0], planes[2]);
+
+	cv::Mat cvMat;
+	cv::merge(planes, cvMat);
+	return cvMat;
+}
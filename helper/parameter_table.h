@@ -0,0 +1,333 @@
+/*
+ * Copyright (c) 2018 Kay Gawlik <kaydev@amarunet.de> <kay.gawlik@beuth-hochschule.de> <kay.gawlik@charite.de>
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "matlab_helper.h"
+#include "matlab_types.h"
+
+
+class ParameterToTable;
+
+/*
+ * parameters of numRows structures of the same type (e.g. the B-scans of a series), one column per parameter:
+ * scalars -> numRows x 1, vectors -> numRows x k, strings and vectors of different length or type -> numRows x 1 cell,
+ * subsets with only the scalars x, y (and z) -> numRows x 2 (x 3), other subsets -> struct of columns
+ */
+class ParameterTable
+{
+	friend class ParameterToTable;
+
+	struct Column
+	{
+		std::string                     name;
+		mxArray*                        values = nullptr; // numeric numRows x width or cell numRows x 1
+		std::size_t                     width  = 0;
+		std::unique_ptr<ParameterTable> subTable;
+	};
+
+	const std::size_t   numRows;
+	const std::size_t*  row; // current row, shared with the sub tables
+	std::size_t         currentRow = 0;
+	std::vector<Column> columns;
+
+	ParameterTable(std::size_t numRows, const std::size_t* row) : numRows(numRows), row(row) {}
+
+	Column& getColumn(const std::string& name)
+	{
+		for(Column& column : columns)
+			if(column.name == name)
+				return column;
+
+		columns.emplace_back();
+		columns.back().name = name;
+		return columns.back();
+	}
+
+	// numeric column -> cell column, the rows so far are kept as width x 1 arrays
+	void toCell(Column& column)
+	{
+		mxArray* cell = mxCreateCellMatrix(static_cast<mwSize>(numRows), 1);
+		if(column.values)
+		{
+			const mxClassID   classID  = mxGetClassID(column.values);
+			const std::size_t elemSize = mxGetElementSize(column.values);
+			const char*       data     = static_cast<const char*>(mxGetData(column.values));
+			for(std::size_t r = 0; r < *row; ++r)
+			{
+				mxArray* value = mxCreateNumericMatrix(static_cast<mwSize>(column.width), 1, classID, mxREAL);
+				char* valueData = static_cast<char*>(mxGetData(value));
+				for(std::size_t j = 0; j < column.width; ++j)
+					std::memcpy(valueData + j*elemSize, data + (r + j*numRows)*elemSize, elemSize);
+				mxSetCell(cell, static_cast<mwIndex>(r), value);
+			}
+			mxDestroyArray(column.values);
+		}
+		column.values = cell;
+	}
+
+	template<typename T, typename Iterator>
+	void setValues(const std::string& name, Iterator values, std::size_t size)
+	{
+		Column& column = getColumn(name);
+		if(!column.values)
+		{
+			column.values = mxCreateNumericMatrix(static_cast<mwSize>(numRows), static_cast<mwSize>(size), MatlabType<T>::classID, mxREAL);
+			column.width  = size;
+		}
+		else if(!mxIsCell(column.values) && (column.width != size || mxGetClassID(column.values) != MatlabType<T>::classID))
+			toCell(column);
+
+		if(mxIsCell(column.values))
+		{
+			mxArray* value = mxCreateNumericMatrix(static_cast<mwSize>(size), 1, MatlabType<T>::classID, mxREAL);
+			T* data = static_cast<T*>(mxGetData(value));
+			for(std::size_t j = 0; j < size; ++j, ++values)
+				data[j] = *values;
+			mxSetCell(column.values, static_cast<mwIndex>(*row), value);
+		}
+		else
+		{
+			T* data = static_cast<T*>(mxGetData(column.values)) + *row;
+			for(std::size_t j = 0; j < size; ++j, ++values)
+				data[j*numRows] = *values;
+		}
+	}
+
+	void setArray(const std::string& name, mxArray* value)
+	{
+		Column& column = getColumn(name);
+		if(!column.values || !mxIsCell(column.values))
+			toCell(column);
+		mxSetCell(column.values, static_cast<mwIndex>(*row), value);
+	}
+
+	ParameterTable& getSubTable(const std::string& name)
+	{
+		Column& column = getColumn(name);
+		if(!column.subTable)
+			column.subTable.reset(new ParameterTable(numRows, row));
+		return *column.subTable;
+	}
+
+	bool isCoordinate() const
+	{
+		static const char* const coordNames[] = { "x", "y", "z" };
+		if(columns.size() < 2 || columns.size() > 3)
+			return false;
+
+		for(std::size_t i = 0; i < columns.size(); ++i)
+		{
+			const Column& column = columns[i];
+			if(column.name != coordNames[i] || column.subTable || !column.values || mxIsCell(column.values) || column.width != 1
+			 || mxGetClassID(column.values) != mxGetClassID(columns[0].values))
+				return false;
+		}
+		return true;
+	}
+
+public:
+	explicit ParameterTable(std::size_t numRows) : numRows(numRows), row(&currentRow) {}
+	ParameterTable(const ParameterTable&) = delete;
+	ParameterTable& operator=(const ParameterTable&) = delete;
+
+	~ParameterTable()
+	{
+		for(Column& column : columns)
+			if(column.values)
+				mxDestroyArray(column.values);
+	}
+
+	void setRow(std::size_t r) { currentRow = r; }
+
+	// the table is empty afterwards
+	mxArray* getMxArray()
+	{
+		if(columns.empty())
+			return nullptr;
+
+		mxArray* mxTable = nullptr;
+		if(isCoordinate())
+		{
+			const std::size_t elemSize = mxGetElementSize(columns[0].values);
+			mxTable = mxCreateNumericMatrix(static_cast<mwSize>(numRows), static_cast<mwSize>(columns.size()), mxGetClassID(columns[0].values), mxREAL);
+			char* data = static_cast<char*>(mxGetData(mxTable));
+			for(std::size_t i = 0; i < columns.size(); ++i)
+				std::memcpy(data + i*numRows*elemSize, mxGetData(columns[i].values), numRows*elemSize);
+		}
+		else
+		{
+			std::vector<const char*> names;
+			for(const Column& column : columns)
+				names.push_back(column.name.c_str());
+
+			mxTable = mxCreateStructMatrix(1, 1, static_cast<int>(names.size()), names.data());
+			for(std::size_t i = 0; i < columns.size(); ++i)
+			{
+				Column& column = columns[i];
+				mxArray* value = column.subTable ? column.subTable->getMxArray() : column.values;
+				column.values = nullptr;
+				mxSetFieldByNumber(mxTable, 0, static_cast<int>(i), value);
+			}
+		}
+
+		for(Column& column : columns)
+			if(column.values)
+				mxDestroyArray(column.values);
+		columns.clear();
+
+		return mxTable;
+	}
+};
+
+
+// getSet visitor for the current row: table.setRow(i); ParameterToTable toTable(table); structure.getSetParameter(toTable);
+class ParameterToTable
+{
+	ParameterTable* table;
+public:
+	explicit ParameterToTable(ParameterTable& table) : table(&table) {}
+
+	template<typename T>
+	void operator()(const std::string& name, const T& value)
+	{
+		table->setValues<T>(name, &value, 1);
+	}
+
+	template<typename T>
+	void operator()(const std::string& name, const std::vector<T>& value)
+	{
+		table->setValues<T>(name, value.begin(), value.size());
+	}
+
+	template<typename T>
+	void operator()(const std::string& name, const std::vector<std::vector<T>>& value)
+	{
+		mxArray* mat = nullptr;
+		createMatlabVector(value, mat);
+		table->setArray(name, mat);
+	}
+
+	void operator()(const std::string& name, const std::string& value)
+	{
+		table->setArray(name, mxCreateString(value.c_str()));
+	}
+
+	ParameterToTable subSet(const std::string& name)
+	{
+		return ParameterToTable(table->getSubTable(name));
+	}
+};
+
+
+// getSet visitor reading one row of a table from ParameterTable::getMxArray()
+class ParameterFromTable
+{
+	const mxArray* mxTable;
+	std::size_t    row;
+
+	// field of the struct, for a coordinate matrix the matrix and the column of x, y or z
+	const mxArray* getValues(const char* name, std::size_t& column) const
+	{
+		column = 0;
+		if(!mxTable)
+			return nullptr;
+
+		const mxArray* values = nullptr;
+		if(mxIsStruct(mxTable))
+			values = mxGetField(mxTable, 0, name);
+		else if(mxIsNumeric(mxTable) && name[0] >= 'x' && name[0] <= 'z' && name[1] == '\0')
+		{
+			column = static_cast<std::size_t>(name[0] - 'x');
+			if(column < mxGetN(mxTable))
+				values = mxTable;
+		}
+
+		if(values && row < mxGetM(values))
+			return values;
+		return nullptr;
+	}
+
+	const mxArray* getCell(const mxArray* values) const
+	{
+		return mxIsCell(values) ? mxGetCell(values, static_cast<mwIndex>(row)) : nullptr;
+	}
+
+public:
+	ParameterFromTable(const mxArray* mxTable, std::size_t row) : mxTable(mxTable), row(row) {}
+
+	template<typename T>
+	void operator()(const char* name, T& value)
+	{
+		std::size_t column;
+		const mxArray* values = getValues(name, column);
+		if(!values)
+			return;
+
+		if(mxIsCell(values))
+		{
+			if(const mxArray* cell = getCell(values))
+				value = getScalarConvert<T>(cell);
+		}
+		else
+			value = getValueConvert<T>(values, row + column*mxGetM(values));
+	}
+
+	template<typename T>
+	void operator()(const char* name, std::vector<T>& value)
+	{
+		std::size_t column;
+		const mxArray* values = getValues(name, column);
+		if(!values)
+			return;
+
+		if(mxIsCell(values))
+		{
+			if(const mxArray* cell = getCell(values))
+				value = getScalarConvert<std::vector<T>>(cell);
+		}
+		else
+		{
+			const std::size_t numRows = mxGetM(values);
+			value.resize(mxGetN(values));
+			for(std::size_t j = 0; j < value.size(); ++j)
+				value[j] = getValueConvert<T>(values, row + j*numRows);
+		}
+	}
+
+	void operator()(const char* name, std::string& value)
+	{
+		std::size_t column;
+		const mxArray* values = getValues(name, column);
+		if(!values)
+			return;
+
+		const mxArray* cell = getCell(values);
+		if(cell && mxIsChar(cell))
+			value = getScalarConvert<std::string>(cell);
+	}
+
+	ParameterFromTable subSet(const std::string& name) const
+	{
+		return ParameterFromTable(mxTable && mxIsStruct(mxTable) ? mxGetField(mxTable, 0, name.c_str()) : nullptr, row);
+	}
+};
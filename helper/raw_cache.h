@@ -0,0 +1,447 @@
+/*
+ * Copyright (c) 2018 Kay Gawlik <kaydev@amarunet.de> <kay.gawlik@beuth-hochschule.de> <kay.gawlik@charite.de>
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "mex.h"
+
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+
+/*
+ * sidecar file with a converted matlab structure (readoctdata option rawCache)
+ *
+ * layout: Header, key, data blocks, tree
+ * Numeric arrays of at least blockMinBytes (B-scan images, volumes, segmentation arrays) are stored as raw blocks in matlab
+ * (column-major) order at offsets aligned to blockAlignment, all other arrays inline in the tree at the end of the file.
+ * A read either copies every block with one sequential read or replaces it by a description for memmapfile
+ * (fields filename, offset, format, repeat), then the data is not touched at all.
+ * The file is only valid for the same key (options) and the same size and modification time of the source file.
+ */
+namespace RawCache
+{
+	constexpr char          magic[8]       = {'O', 'C', 'T', 'R', 'A', 'W', '\0', '\0'};
+	constexpr std::uint32_t version        = 1;
+	constexpr std::uint32_t byteOrderMark  = 0x01020304;
+	constexpr std::uint64_t blockAlignment = 4096;
+	constexpr std::uint64_t blockMinBytes  = 64*1024;
+
+	struct Header
+	{
+		char          magic[8];
+		std::uint32_t version;
+		std::uint32_t byteOrder;   // files of a machine with other byte order are rejected
+		std::int64_t  sourceMtime;
+		std::uint64_t sourceSize;
+		std::uint64_t keySize;     // the key follows the header
+		std::uint64_t treeOffset;
+		std::uint64_t treeSize;
+	};
+	static_assert(sizeof(Header) == 56, "RawCache::Header without padding");
+
+	enum class Mode { Copy, Map };
+
+	enum NodeType : std::uint8_t { Null, Inline, Block, Struct, Cell };
+
+	inline const char* getMemmapClassName(mxClassID classID)
+	{
+		switch(classID)
+		{
+			case mxDOUBLE_CLASS: return "double";
+			case mxSINGLE_CLASS: return "single";
+			case mxINT8_CLASS  : return "int8"  ;
+			case mxUINT8_CLASS : return "uint8" ;
+			case mxINT16_CLASS : return "int16" ;
+			case mxUINT16_CLASS: return "uint16";
+			case mxINT32_CLASS : return "int32" ;
+			case mxUINT32_CLASS: return "uint32";
+			case mxINT64_CLASS : return "int64" ;
+			case mxUINT64_CLASS: return "uint64";
+			default:
+				return nullptr;
+		}
+	}
+
+
+	class Writer
+	{
+		std::ofstream stream;
+		std::string   tree;
+		std::uint64_t position = 0;
+
+		template<typename T>
+		void put(T value)
+		{
+			tree.append(reinterpret_cast<const char*>(&value), sizeof(T));
+		}
+
+		bool writeBlock(const mxArray* matlabMat, std::uint64_t numBytes)
+		{
+			const std::uint64_t offset = (position + blockAlignment - 1)/blockAlignment*blockAlignment;
+			const std::string padding(static_cast<std::size_t>(offset - position), '\0');
+			stream.write(padding.data(), static_cast<std::streamsize>(padding.size()));
+			stream.write(static_cast<const char*>(mxGetData(matlabMat)), static_cast<std::streamsize>(numBytes));
+			position = offset + numBytes;
+
+			put(offset);
+			put(numBytes);
+			return static_cast<bool>(stream);
+		}
+
+		bool writeNode(const mxArray* matlabMat)
+		{
+			if(!matlabMat)
+			{
+				put(NodeType::Null);
+				return true;
+			}
+
+			const mxClassID classID = mxGetClassID(matlabMat);
+			const bool      numeric = mxIsNumeric(matlabMat);
+			if(!numeric && !mxIsChar(matlabMat) && !mxIsLogical(matlabMat) && !mxIsStruct(matlabMat) && !mxIsCell(matlabMat))
+				return false;
+
+			const std::uint64_t numel    = mxGetNumberOfElements(matlabMat);
+			const std::uint64_t numBytes = numel*mxGetElementSize(matlabMat);
+
+			NodeType type = NodeType::Inline;
+			if(mxIsStruct(matlabMat))
+				type = NodeType::Struct;
+			else if(mxIsCell(matlabMat))
+				type = NodeType::Cell;
+			else if(numeric && numBytes >= blockMinBytes)
+				type = NodeType::Block;
+
+			put(type);
+			put(static_cast<std::uint32_t>(classID));
+			const mwSize  ndims = mxGetNumberOfDimensions(matlabMat);
+			const mwSize* dims  = mxGetDimensions(matlabMat);
+			put(static_cast<std::uint64_t>(ndims));
+			for(mwSize d = 0; d < ndims; ++d)
+				put(static_cast<std::uint64_t>(dims[d]));
+
+			switch(type)
+			{
+				case NodeType::Struct:
+				{
+					const int numFields = mxGetNumberOfFields(matlabMat);
+					put(static_cast<std::uint32_t>(numFields));
+					for(int field = 0; field < numFields; ++field)
+					{
+						const char* name = mxGetFieldNameByNumber(matlabMat, field);
+						put(static_cast<std::uint32_t>(std::strlen(name)));
+						tree.append(name);
+					}
+					for(std::uint64_t i = 0; i < numel; ++i)
+						for(int field = 0; field < numFields; ++field)
+							if(!writeNode(mxGetFieldByNumber(matlabMat, static_cast<mwIndex>(i), field)))
+								return false;
+					return true;
+				}
+				case NodeType::Cell:
+					for(std::uint64_t i = 0; i < numel; ++i)
+						if(!writeNode(mxGetCell(matlabMat, static_cast<mwIndex>(i))))
+							return false;
+					return true;
+				case NodeType::Block:
+					return writeBlock(matlabMat, numBytes);
+				case NodeType::Inline:
+				case NodeType::Null:
+					break;
+			}
+
+			put(numBytes);
+			if(numBytes > 0)
+				tree.append(static_cast<const char*>(mxGetData(matlabMat)), static_cast<std::size_t>(numBytes));
+			return true;
+		}
+
+	public:
+		// writes to filename.tmp and renames it, so a reader never sees a partial file
+		bool write(const std::string& filename, const mxArray* matlabMat, std::int64_t sourceMtime, std::uint64_t sourceSize, const std::string& key)
+		{
+			const std::string tmpFilename = filename + ".tmp";
+			stream.open(tmpFilename, std::ios::binary | std::ios::trunc);
+			if(!stream)
+				return false;
+
+			Header header = {};
+			std::memcpy(header.magic, magic, sizeof(magic));
+			header.version     = version;
+			header.byteOrder   = byteOrderMark;
+			header.sourceMtime = sourceMtime;
+			header.sourceSize  = sourceSize;
+			header.keySize     = key.size();
+
+			stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+			stream.write(key.data(), static_cast<std::streamsize>(key.size()));
+			position = sizeof(header) + key.size();
+
+			tree.clear();
+			bool success = writeNode(matlabMat);
+
+			header.treeOffset = position;
+			header.treeSize   = tree.size();
+			stream.write(tree.data(), static_cast<std::streamsize>(tree.size()));
+			stream.seekp(0);
+			stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+			stream.close();
+			success = success && !stream.fail();
+
+			std::error_code ec;
+			if(success)
+			{
+				std::filesystem::rename(tmpFilename, filename, ec);
+				if(ec) // e.g. an existing file that can not be replaced
+				{
+					std::filesystem::remove(filename, ec);
+					std::filesystem::rename(tmpFilename, filename, ec);
+				}
+				success = !ec;
+			}
+			if(!success)
+				std::filesystem::remove(tmpFilename, ec);
+			return success;
+		}
+	};
+
+
+	class Reader
+	{
+		std::ifstream     stream;
+		std::string       filename;
+		Mode              mode = Mode::Copy;
+		std::vector<char> tree;
+		std::size_t       pos      = 0;
+		std::uint64_t     fileSize = 0;
+		bool              failed   = false;
+
+		template<typename T>
+		T get()
+		{
+			T value = T();
+			if(tree.size() - pos < sizeof(T))
+			{
+				failed = true;
+				return value;
+			}
+			std::memcpy(&value, tree.data() + pos, sizeof(T));
+			pos += sizeof(T);
+			return value;
+		}
+
+		std::string getString(std::size_t size)
+		{
+			if(tree.size() - pos < size)
+			{
+				failed = true;
+				return std::string();
+			}
+			std::string str(tree.data() + pos, size);
+			pos += size;
+			return str;
+		}
+
+		mxArray* createMemmapDescription(mxClassID classID, const std::vector<mwSize>& dims, std::uint64_t offset)
+		{
+			const char* className = getMemmapClassName(classID);
+			if(!className)
+			{
+				failed = true;
+				return nullptr;
+			}
+
+			mxArray* mxDims = mxCreateNumericMatrix(1, static_cast<mwSize>(dims.size()), mxDOUBLE_CLASS, mxREAL);
+			double*  dimPtr = mxGetPr(mxDims);
+			for(mwSize dim : dims)
+				*dimPtr++ = static_cast<double>(dim);
+
+			mxArray* format = mxCreateCellMatrix(1, 3);
+			mxSetCell(format, 0, mxCreateString(className));
+			mxSetCell(format, 1, mxDims);
+			mxSetCell(format, 2, mxCreateString("data"));
+
+			const char* fieldNames[] = { "filename", "offset", "format", "repeat" };
+			mxArray* description = mxCreateStructMatrix(1, 1, 4, fieldNames);
+			mxSetField(description, 0, "filename", mxCreateString(filename.c_str()));
+			mxSetField(description, 0, "offset"  , mxCreateDoubleScalar(static_cast<double>(offset)));
+			mxSetField(description, 0, "format"  , format);
+			mxSetField(description, 0, "repeat"  , mxCreateDoubleScalar(1));
+			return description;
+		}
+
+		mxArray* createArray(mxClassID classID, const std::vector<mwSize>& dims)
+		{
+			if(classID == mxCHAR_CLASS)
+				return mxCreateCharArray(static_cast<mwSize>(dims.size()), dims.data());
+			if(classID == mxLOGICAL_CLASS)
+				return mxCreateLogicalArray(static_cast<mwSize>(dims.size()), dims.data());
+			if(getMemmapClassName(classID))
+				return mxCreateNumericArray(static_cast<mwSize>(dims.size()), dims.data(), classID, mxREAL);
+			failed = true;
+			return nullptr;
+		}
+
+		// nullptr and failed on a corrupt tree, a partly read structure is destroyed
+		mxArray* readNode()
+		{
+			const NodeType type = static_cast<NodeType>(get<std::uint8_t>());
+			if(failed || type == NodeType::Null)
+				return nullptr;
+
+			const mxClassID     classID = static_cast<mxClassID>(get<std::uint32_t>());
+			const std::uint64_t ndims   = get<std::uint64_t>();
+			if(failed || ndims < 2 || ndims > 32)
+			{
+				failed = true;
+				return nullptr;
+			}
+			std::vector<mwSize> dims(static_cast<std::size_t>(ndims));
+			std::uint64_t numel = 1;
+			for(mwSize& dim : dims)
+			{
+				dim = static_cast<mwSize>(get<std::uint64_t>());
+				numel *= dim;
+			}
+			if(failed)
+				return nullptr;
+
+			mxArray* matlabMat = nullptr;
+			switch(type)
+			{
+				case NodeType::Struct:
+				{
+					const std::uint32_t numFields = get<std::uint32_t>();
+					std::vector<std::string> names;
+					for(std::uint32_t field = 0; field < numFields && !failed; ++field)
+						names.push_back(getString(get<std::uint32_t>()));
+					if(failed || numel > tree.size() || numel*numFields > tree.size()) // every child needs at least one byte
+						break;
+
+					std::vector<const char*> namePtrs;
+					for(const std::string& name : names)
+						namePtrs.push_back(name.c_str());
+					matlabMat = mxCreateStructArray(static_cast<mwSize>(ndims), dims.data(), static_cast<int>(numFields), namePtrs.data());
+					for(std::uint64_t i = 0; i < numel && !failed; ++i)
+						for(std::uint32_t field = 0; field < numFields && !failed; ++field)
+							mxSetFieldByNumber(matlabMat, static_cast<mwIndex>(i), static_cast<int>(field), readNode());
+					break;
+				}
+				case NodeType::Cell:
+				{
+					if(numel > tree.size())
+						break;
+					matlabMat = mxCreateCellArray(static_cast<mwSize>(ndims), dims.data());
+					for(std::uint64_t i = 0; i < numel && !failed; ++i)
+						mxSetCell(matlabMat, static_cast<mwIndex>(i), readNode());
+					break;
+				}
+				case NodeType::Block:
+				{
+					const std::uint64_t offset   = get<std::uint64_t>();
+					const std::uint64_t numBytes = get<std::uint64_t>();
+					if(failed || numel > numBytes || offset > fileSize || numBytes > fileSize - offset)
+						break;
+					if(mode == Mode::Map)
+						return createMemmapDescription(classID, dims, offset);
+
+					matlabMat = createArray(classID, dims);
+					if(!matlabMat || numel*mxGetElementSize(matlabMat) != numBytes)
+						break;
+					stream.seekg(static_cast<std::streamoff>(offset));
+					stream.read(static_cast<char*>(mxGetData(matlabMat)), static_cast<std::streamsize>(numBytes));
+					if(!stream)
+						failed = true;
+					return matlabMat;
+				}
+				case NodeType::Inline:
+				{
+					const std::uint64_t numBytes = get<std::uint64_t>();
+					if(failed || numel > numBytes || numBytes > tree.size() - pos)
+						break;
+					matlabMat = createArray(classID, dims);
+					if(!matlabMat || numel*mxGetElementSize(matlabMat) != numBytes)
+						break;
+					if(numBytes > 0)
+						std::memcpy(mxGetData(matlabMat), tree.data() + pos, static_cast<std::size_t>(numBytes));
+					pos += static_cast<std::size_t>(numBytes);
+					return matlabMat;
+				}
+				case NodeType::Null:
+					break;
+			}
+
+			if(!failed && (type == NodeType::Struct || type == NodeType::Cell) && matlabMat)
+				return matlabMat;
+
+			failed = true;
+			if(matlabMat)
+				mxDestroyArray(matlabMat);
+			return nullptr;
+		}
+
+	public:
+		// nullptr if the file does not exist, is corrupt or belongs to another source file or key
+		mxArray* read(const std::string& cacheFilename, std::int64_t sourceMtime, std::uint64_t sourceSize, const std::string& key, Mode readMode)
+		{
+			filename = cacheFilename;
+			mode     = readMode;
+			stream.open(filename, std::ios::binary);
+			if(!stream)
+				return nullptr;
+
+			Header header;
+			if(!stream.read(reinterpret_cast<char*>(&header), sizeof(header))
+			|| std::memcmp(header.magic, magic, sizeof(magic)) != 0
+			|| header.version     != version
+			|| header.byteOrder   != byteOrderMark
+			|| header.sourceMtime != sourceMtime
+			|| header.sourceSize  != sourceSize
+			|| header.keySize     != key.size())
+				return nullptr;
+
+			std::string fileKey(static_cast<std::size_t>(header.keySize), '\0');
+			if(!stream.read(&fileKey[0], static_cast<std::streamsize>(fileKey.size())) || fileKey != key)
+				return nullptr;
+
+			stream.seekg(0, std::ios::end);
+			fileSize = static_cast<std::uint64_t>(stream.tellg());
+			if(header.treeOffset > fileSize || header.treeSize > fileSize - header.treeOffset)
+				return nullptr;
+
+			tree.resize(static_cast<std::size_t>(header.treeSize));
+			stream.seekg(static_cast<std::streamoff>(header.treeOffset));
+			if(!stream.read(tree.data(), static_cast<std::streamsize>(tree.size())))
+				return nullptr;
+
+			pos    = 0;
+			failed = false;
+			mxArray* matlabMat = readNode();
+			if(failed && matlabMat)
+			{
+				mxDestroyArray(matlabMat);
+				matlabMat = nullptr;
+			}
+			return matlabMat;
+		}
+	};
+}
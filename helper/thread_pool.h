@@ -0,0 +1,214 @@
+/*
+ * Copyright (c) 2018 Kay Gawlik <kaydev@amarunet.de> <kay.gawlik@beuth-hochschule.de> <kay.gawlik@charite.de>
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+
+// 0 -> number of cores
+inline std::size_t getNumThreads(int numThreads)
+{
+	if(numThreads > 0)
+		return static_cast<std::size_t>(numThreads);
+
+	const unsigned int cores = std::thread::hardware_concurrency();
+	return cores > 0 ? cores : 1;
+}
+
+
+/*
+ * calls func(i) for i in [0, count) with up to numThreads threads, the calling thread takes part.
+ * func must not use the mex API (mxCreate*, mexPrintf, ...), it is not thread safe.
+ * The first exception thrown by func is rethrown in the calling thread.
+ */
+template<typename Func>
+void parallelFor(std::size_t count, std::size_t numThreads, Func&& func)
+{
+	if(numThreads <= 1 || count <= 1)
+	{
+		for(std::size_t i = 0; i < count; ++i)
+			func(i);
+		return;
+	}
+
+	numThreads = std::min(numThreads, count);
+
+	std::atomic<std::size_t> next(0);
+	std::exception_ptr       error;
+	std::mutex               errorMutex;
+
+	auto worker = [&]()
+	{
+		for(std::size_t i = next++; i < count; i = next++)
+		{
+			try
+			{
+				func(i);
+			}
+			catch(...)
+			{
+				std::lock_guard<std::mutex> lock(errorMutex);
+				if(!error)
+					error = std::current_exception();
+				next = count;
+			}
+		}
+	};
+
+	std::vector<std::thread> threads;
+	threads.reserve(numThreads - 1);
+	for(std::size_t i = 1; i < numThreads; ++i)
+		threads.emplace_back(worker);
+
+	worker();
+
+	for(std::thread& thread : threads)
+		thread.join();
+
+	if(error)
+		std::rethrow_exception(error);
+}
+
+
+/*
+ * produce(i) runs for i in [0, count) on numThreads worker threads, consume(i, result) runs on the calling thread
+ * in the order the results are finished. Only the calling thread may use the mex API.
+ * A new result i is only started while less than maxInFlight results are produced but not consumed and the budget
+ * holds estimate(i) in addition: a result counts with estimate(i) while it is produced and with cost(result) until it is
+ * consumed. At least one result is always allowed. estimate is called with the lock held, it has to be cheap.
+ * The first exception of produce or consume is rethrown in the calling thread after all workers are stopped.
+ */
+template<typename Result, typename Produce, typename Estimate, typename Cost, typename Consume>
+void produceConsume(std::size_t count, std::size_t numThreads, std::size_t maxInFlight, std::size_t budget
+                  , Produce&& produce, Estimate&& estimate, Cost&& cost, Consume&& consume)
+{
+	typedef std::tuple<std::size_t, Result, std::size_t> Item; // index, result, cost
+
+	std::mutex              mutex;
+	std::condition_variable producerCondition;
+	std::condition_variable consumerCondition;
+	std::deque<Item>        ready;
+	std::size_t             next         = 0;
+	std::size_t             inFlight     = 0;
+	std::size_t             inFlightCost = 0;
+	bool                    stop         = false;
+	std::exception_ptr      error;
+
+	auto worker = [&]()
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		for(;;)
+		{
+			producerCondition.wait(lock, [&]
+				{
+					return stop || next >= count || inFlight == 0
+					    || (inFlight < maxInFlight && inFlightCost <= budget && estimate(next) <= budget - inFlightCost);
+				});
+			if(stop || next >= count)
+				return;
+
+			const std::size_t index    = next++;
+			const std::size_t reserved = estimate(index);
+			++inFlight;
+			inFlightCost += reserved;
+			lock.unlock();
+
+			try
+			{
+				Result result = produce(index);
+				const std::size_t resultCost = cost(result);
+				lock.lock();
+				inFlightCost = inFlightCost - reserved + resultCost; // the estimate is replaced by the actual cost
+				ready.emplace_back(index, std::move(result), resultCost);
+				if(resultCost < reserved)
+					producerCondition.notify_all();
+			}
+			catch(...)
+			{
+				if(!lock.owns_lock())
+					lock.lock();
+				if(!error)
+					error = std::current_exception();
+				stop = true;
+				producerCondition.notify_all();
+			}
+			consumerCondition.notify_one();
+		}
+	};
+
+	std::vector<std::thread> threads;
+
+	auto stopWorkers = [&]()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stop = true;
+		}
+		producerCondition.notify_all();
+		for(std::thread& thread : threads)
+			thread.join();
+		threads.clear();
+	};
+
+	// stop and join the workers also if consume throws
+	struct Joiner
+	{
+		decltype(stopWorkers)& stop;
+		~Joiner() { stop(); }
+	} joiner{stopWorkers};
+
+	numThreads = std::max(std::size_t(1), std::min(numThreads, count));
+	for(std::size_t i = 0; i < numThreads; ++i)
+		threads.emplace_back(worker);
+
+	for(std::size_t consumed = 0; consumed < count; ++consumed)
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		consumerCondition.wait(lock, [&] { return !ready.empty() || error; });
+		if(ready.empty())
+			break;
+
+		std::size_t itemCost;
+		{
+			Item item = std::move(ready.front());
+			ready.pop_front();
+			lock.unlock();
+
+			itemCost = std::get<2>(item);
+			consume(std::get<0>(item), std::get<1>(item));
+		} // result released
+
+		lock.lock();
+		--inFlight;
+		inFlightCost -= itemCost;
+		producerCondition.notify_all();
+	}
+
+	stopWorkers();
+
+	if(error)
+		std::rethrow_exception(error);
+}
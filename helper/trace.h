@@ -0,0 +1,268 @@
+/*
+ * Copyright (c) 2018 Kay Gawlik <kaydev@amarunet.de> <kay.gawlik@beuth-hochschule.de> <kay.gawlik@charite.de>
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+
+/*
+ * begin / end events of the conversion, written as chrome trace json (chrome://tracing, ui.perfetto.dev).
+ *
+ * Trace::Scope records one event for its lifetime if tracing is enabled, otherwise it costs one relaxed atomic load.
+ * Every thread writes into its own buffer of chunks without locks, the size of a chunk is published with release / acquire,
+ * so the events can be collected while other threads (e.g. prefetch) are still recording.
+ * Trace::Session enables the tracing for one call and writes the events of all threads to the file.
+ */
+namespace Trace
+{
+	struct Event
+	{
+		const char*  name;  // string literal
+		std::int64_t begin; // ns, steady clock
+		std::int64_t end;
+		std::int64_t arg;   // e.g. B-scan index, < 0 -> none
+	};
+
+	struct Chunk
+	{
+		static constexpr std::size_t capacity = 4096;
+
+		Event                    events[capacity];
+		std::atomic<std::size_t> size{0};
+		std::atomic<Chunk*>      next{nullptr};
+	};
+
+	struct ThreadBuffer
+	{
+		std::uint32_t     threadId = 0;
+		Chunk*            tail     = nullptr; // only used by the recording thread
+		Chunk*            head     = nullptr; // read position, only used by collect() with the registry mutex
+		std::size_t       read     = 0;
+		std::atomic<bool> finished{false};    // thread ended, the buffer is deleted after its events are collected
+
+		~ThreadBuffer()
+		{
+			while(head)
+			{
+				Chunk* next = head->next.load(std::memory_order_acquire);
+				delete head;
+				head = next;
+			}
+		}
+	};
+
+	struct Registry
+	{
+		std::mutex                                 mutex;
+		std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+		std::uint32_t                              nextThreadId = 1;
+		std::atomic<bool>                          enabled{false};
+	};
+
+	inline Registry& getRegistry()
+	{
+		static Registry registry;
+		return registry;
+	}
+
+	inline std::int64_t now()
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	inline bool isEnabled()
+	{
+		return getRegistry().enabled.load(std::memory_order_relaxed);
+	}
+
+	inline ThreadBuffer* registerThread()
+	{
+		Registry& registry = getRegistry();
+		std::unique_ptr<ThreadBuffer> buffer = std::make_unique<ThreadBuffer>();
+		buffer->tail = buffer->head = new Chunk;
+
+		std::lock_guard<std::mutex> lock(registry.mutex);
+		buffer->threadId = registry.nextThreadId++;
+		registry.buffers.push_back(std::move(buffer));
+		return registry.buffers.back().get();
+	}
+
+	inline ThreadBuffer& getThreadBuffer()
+	{
+		struct Holder
+		{
+			ThreadBuffer* buffer = registerThread();
+			~Holder() { buffer->finished.store(true, std::memory_order_release); }
+		};
+		thread_local Holder holder;
+		return *holder.buffer;
+	}
+
+	inline void record(const char* name, std::int64_t begin, std::int64_t end, std::int64_t arg)
+	{
+		ThreadBuffer& buffer = getThreadBuffer();
+		Chunk* chunk = buffer.tail;
+		std::size_t size = chunk->size.load(std::memory_order_relaxed);
+		if(size == Chunk::capacity)
+		{
+			Chunk* next = new Chunk;
+			chunk->next.store(next, std::memory_order_release);
+			buffer.tail = chunk = next;
+			size = 0;
+		}
+		chunk->events[size] = Event{name, begin, end, arg};
+		chunk->size.store(size + 1, std::memory_order_release);
+	}
+
+	// calls func(threadId, event) for the events recorded since the last collect, frees the read chunks and the buffers of ended threads
+	template<typename Func>
+	void collect(Func&& func)
+	{
+		Registry& registry = getRegistry();
+		std::lock_guard<std::mutex> lock(registry.mutex);
+
+		for(std::size_t b = 0; b < registry.buffers.size();)
+		{
+			ThreadBuffer& buffer   = *registry.buffers[b];
+			const bool    finished = buffer.finished.load(std::memory_order_acquire);
+			for(;;)
+			{
+				Chunk* chunk = buffer.head;
+				const std::size_t size = chunk->size.load(std::memory_order_acquire);
+				for(; buffer.read < size; ++buffer.read)
+					func(buffer.threadId, chunk->events[buffer.read]);
+
+				Chunk* next = chunk->next.load(std::memory_order_acquire);
+				if(!next)
+					break;
+				if(buffer.read < Chunk::capacity)
+					continue; // filled since the size was read
+
+				buffer.head = next;
+				buffer.read = 0;
+				delete chunk;
+			}
+
+			if(finished)
+				registry.buffers.erase(registry.buffers.begin() + static_cast<std::ptrdiff_t>(b));
+			else
+				++b;
+		}
+	}
+
+	inline bool writeChromeTrace(const std::string& filename, std::int64_t startTime)
+	{
+		std::ofstream stream(filename);
+		if(!stream)
+			return false;
+
+		stream << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+		stream.setf(std::ios::fixed);
+		stream.precision(3);
+
+		bool first = true;
+		collect([&](std::uint32_t threadId, const Event& event)
+			{
+				if(event.end < startTime)
+					return;
+
+				// the names are string literals without characters to escape
+				stream << (first ? "" : ",\n")
+				       << "{\"name\":\"" << event.name << "\",\"cat\":\"octdata\",\"ph\":\"X\",\"pid\":1,\"tid\":" << threadId
+				       << ",\"ts\":"  << static_cast<double>(event.begin - startTime)*1e-3
+				       << ",\"dur\":" << static_cast<double>(event.end - event.begin)*1e-3;
+				if(event.arg >= 0)
+					stream << ",\"args\":{\"index\":" << event.arg << '}';
+				stream << '}';
+				first = false;
+			});
+
+		stream << "\n]}\n";
+		return static_cast<bool>(stream);
+	}
+
+
+	// records one event from construction to destruction, arg e.g. the B-scan index
+	class Scope
+	{
+		const char*  name;
+		std::int64_t arg;
+		std::int64_t begin;
+		bool         active;
+	public:
+		explicit Scope(const char* name, std::int64_t arg = -1) : name(name), arg(arg), begin(0), active(isEnabled())
+		{
+			if(active)
+				begin = now();
+		}
+
+		~Scope()
+		{
+			if(active)
+				record(name, begin, now(), arg);
+		}
+
+		Scope(const Scope&) = delete;
+		Scope& operator=(const Scope&) = delete;
+	};
+
+	// tracing of one call, nothing without filename
+	class Session
+	{
+		std::string  filename;
+		std::int64_t startTime = 0;
+	public:
+		explicit Session(const std::string& filename) : filename(filename)
+		{
+			if(filename.empty())
+				return;
+
+			collect([](std::uint32_t, const Event&) {}); // drop events of earlier sessions
+			startTime = now();
+			getRegistry().enabled.store(true, std::memory_order_relaxed);
+		}
+
+		~Session()
+		{
+			if(!filename.empty())
+				getRegistry().enabled.store(false, std::memory_order_relaxed);
+		}
+
+		Session(const Session&) = delete;
+		Session& operator=(const Session&) = delete;
+
+		// stops the tracing and writes the file, false if it can not be written
+		bool finish()
+		{
+			if(filename.empty())
+				return true;
+
+			getRegistry().enabled.store(false, std::memory_order_relaxed);
+			const bool result = writeChromeTrace(filename, startTime);
+			filename.clear();
+			return result;
+		}
+	};
+}
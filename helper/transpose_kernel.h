@@ -0,0 +1,515 @@
+/*
+ * Copyright (c) 2018 Kay Gawlik <kaydev@amarunet.de> <kay.gawlik@beuth-hochschule.de> <kay.gawlik@charite.de>
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#define OCTDATA4MATLAB_SSE2
+	#include <emmintrin.h>
+#endif
+
+#if defined(OCTDATA4MATLAB_SSE2) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	#define OCTDATA4MATLAB_AVX2
+	#define OCTDATA4MATLAB_SSSE3
+	#include <immintrin.h>
+#endif
+
+
+/*
+ * Transpose kernels for the copy between opencv (row based) and matlab (col based) matrices.
+ *
+ * All functions copy a source matrix with rows x cols elements into a transposed destination:
+ *   dst[j*dstRowStride + i*dstPixStride] = src[i*srcRowStride + j*srcPixStride]
+ * Strides are given in elements, not in bytes.
+ *
+ * Continuous rows (pixel stride 1) are copied with SSE2 / AVX2 block kernels,
+ * the kernel is selected once at runtime. All other cases use a cache blocked scalar copy.
+ *
+ * 3 channel images (colour SLO / fundus) are split into (or merged from) the three planes in the same pass,
+ * see deinterleaveTransposeCopy() and interleaveTransposeCopy().
+ */
+namespace TransposeKernel
+{
+	constexpr std::size_t tileSize = 64; // multiple of every block size below
+
+	template<typename T>
+	void transposeScalar(const T* src, std::size_t srcRowStride, std::size_t srcPixStride
+	                   ,       T* dst, std::size_t dstRowStride, std::size_t dstPixStride
+	                   , std::size_t rows, std::size_t cols)
+	{
+		constexpr std::size_t blockSize = sizeof(T) < 8 ? 64/sizeof(T) : 8;
+
+		for(std::size_t bi = 0; bi < rows; bi += blockSize)
+		{
+			const std::size_t biEnd = std::min(bi + blockSize, rows);
+			for(std::size_t bj = 0; bj < cols; bj += blockSize)
+			{
+				const std::size_t bjEnd = std::min(bj + blockSize, cols);
+				for(std::size_t i = bi; i < biEnd; ++i)
+				{
+					const T* srcIt = src + i*srcRowStride + bj*srcPixStride;
+					      T* dstIt = dst + bj*dstRowStride + i*dstPixStride;
+					for(std::size_t j = bj; j < bjEnd; ++j)
+					{
+						*dstIt = *srcIt;
+						srcIt += srcPixStride;
+						dstIt += dstRowStride;
+					}
+				}
+			}
+		}
+	}
+
+	/*
+	 * Block kernels: transposeBlocks() handles a region whose size is a multiple of blockRows x blockCols.
+	 * The in register transpose interleaves row i with row i+n/2 log2(n) times (perfect shuffle).
+	 */
+#ifdef OCTDATA4MATLAB_SSE2
+	template<std::size_t ElemSize> struct UnpackSSE2;
+	template<> struct UnpackSSE2<1> { static __m128i lo(__m128i a, __m128i b) { return _mm_unpacklo_epi8 (a, b); } static __m128i hi(__m128i a, __m128i b) { return _mm_unpackhi_epi8 (a, b); } };
+	template<> struct UnpackSSE2<2> { static __m128i lo(__m128i a, __m128i b) { return _mm_unpacklo_epi16(a, b); } static __m128i hi(__m128i a, __m128i b) { return _mm_unpackhi_epi16(a, b); } };
+	template<> struct UnpackSSE2<4> { static __m128i lo(__m128i a, __m128i b) { return _mm_unpacklo_epi32(a, b); } static __m128i hi(__m128i a, __m128i b) { return _mm_unpackhi_epi32(a, b); } };
+	template<> struct UnpackSSE2<8> { static __m128i lo(__m128i a, __m128i b) { return _mm_unpacklo_epi64(a, b); } static __m128i hi(__m128i a, __m128i b) { return _mm_unpackhi_epi64(a, b); } };
+
+	// 16x16 (8 bit), 8x8 (16 bit), 4x4 (32 bit) and 2x2 (64 bit) blocks
+	template<std::size_t ElemSize>
+	struct BlockSSE2
+	{
+		static constexpr std::size_t blockRows = 16/ElemSize;
+		static constexpr std::size_t blockCols = 16/ElemSize;
+
+		static void transposeRegister(__m128i* r)
+		{
+			constexpr std::size_t n = blockRows;
+			__m128i t[n];
+			for(std::size_t stage = n; stage > 1; stage /= 2)
+			{
+				for(std::size_t i = 0; i < n/2; ++i)
+				{
+					t[2*i    ] = UnpackSSE2<ElemSize>::lo(r[i], r[i + n/2]);
+					t[2*i + 1] = UnpackSSE2<ElemSize>::hi(r[i], r[i + n/2]);
+				}
+				for(std::size_t i = 0; i < n; ++i)
+					r[i] = t[i];
+			}
+		}
+
+		static void transposeBlocks(const char* src, std::size_t srcStep, char* dst, std::size_t dstStep, std::size_t rows, std::size_t cols)
+		{
+			__m128i r[blockRows];
+			for(std::size_t i = 0; i < rows; i += blockRows)
+			{
+				for(std::size_t j = 0; j < cols; j += blockCols)
+				{
+					const char* srcBlock = src + i*srcStep + j*ElemSize;
+					      char* dstBlock = dst + j*dstStep + i*ElemSize;
+					for(std::size_t k = 0; k < blockRows; ++k)
+						r[k] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(srcBlock + k*srcStep));
+					transposeRegister(r);
+					for(std::size_t k = 0; k < blockCols; ++k)
+						_mm_storeu_si128(reinterpret_cast<__m128i*>(dstBlock + k*dstStep), r[k]);
+				}
+			}
+		}
+	};
+#endif
+
+#ifdef OCTDATA4MATLAB_AVX2
+	#define OCTDATA4MATLAB_TARGET_AVX2 __attribute__((target("avx2")))
+
+	template<std::size_t ElemSize> struct UnpackAVX2;
+	template<> struct UnpackAVX2<1> { OCTDATA4MATLAB_TARGET_AVX2 static __m256i lo(__m256i a, __m256i b) { return _mm256_unpacklo_epi8 (a, b); } OCTDATA4MATLAB_TARGET_AVX2 static __m256i hi(__m256i a, __m256i b) { return _mm256_unpackhi_epi8 (a, b); } };
+	template<> struct UnpackAVX2<2> { OCTDATA4MATLAB_TARGET_AVX2 static __m256i lo(__m256i a, __m256i b) { return _mm256_unpacklo_epi16(a, b); } OCTDATA4MATLAB_TARGET_AVX2 static __m256i hi(__m256i a, __m256i b) { return _mm256_unpackhi_epi16(a, b); } };
+	template<> struct UnpackAVX2<4> { OCTDATA4MATLAB_TARGET_AVX2 static __m256i lo(__m256i a, __m256i b) { return _mm256_unpacklo_epi32(a, b); } OCTDATA4MATLAB_TARGET_AVX2 static __m256i hi(__m256i a, __m256i b) { return _mm256_unpackhi_epi32(a, b); } };
+	template<> struct UnpackAVX2<8> { OCTDATA4MATLAB_TARGET_AVX2 static __m256i lo(__m256i a, __m256i b) { return _mm256_unpacklo_epi64(a, b); } OCTDATA4MATLAB_TARGET_AVX2 static __m256i hi(__m256i a, __m256i b) { return _mm256_unpackhi_epi64(a, b); } };
+
+	// two SSE2 blocks side by side in the 128 bit lanes: 32x16 (8 bit), 16x8 (16 bit), 8x4 (32 bit), 4x2 (64 bit)
+	// lane 0 holds source row k, lane 1 source row k+n, so every transposed register is one full destination row
+	template<std::size_t ElemSize>
+	struct BlockAVX2
+	{
+		static constexpr std::size_t blockCols = 16/ElemSize;
+		static constexpr std::size_t blockRows = 2*blockCols;
+
+		OCTDATA4MATLAB_TARGET_AVX2 static void transposeRegister(__m256i* r)
+		{
+			constexpr std::size_t n = blockCols;
+			__m256i t[n];
+			for(std::size_t stage = n; stage > 1; stage /= 2)
+			{
+				for(std::size_t i = 0; i < n/2; ++i)
+				{
+					t[2*i    ] = UnpackAVX2<ElemSize>::lo(r[i], r[i + n/2]);
+					t[2*i + 1] = UnpackAVX2<ElemSize>::hi(r[i], r[i + n/2]);
+				}
+				for(std::size_t i = 0; i < n; ++i)
+					r[i] = t[i];
+			}
+		}
+
+		OCTDATA4MATLAB_TARGET_AVX2 static void transposeBlocks(const char* src, std::size_t srcStep, char* dst, std::size_t dstStep, std::size_t rows, std::size_t cols)
+		{
+			constexpr std::size_t n = blockCols;
+			__m256i r[n];
+			for(std::size_t i = 0; i < rows; i += blockRows)
+			{
+				for(std::size_t j = 0; j < cols; j += blockCols)
+				{
+					const char* srcBlock = src + i*srcStep + j*ElemSize;
+					      char* dstBlock = dst + j*dstStep + i*ElemSize;
+					for(std::size_t k = 0; k < n; ++k)
+					{
+						const __m128i low  = _mm_loadu_si128(reinterpret_cast<const __m128i*>(srcBlock + k    *srcStep));
+						const __m128i high = _mm_loadu_si128(reinterpret_cast<const __m128i*>(srcBlock + (k+n)*srcStep));
+						r[k] = _mm256_inserti128_si256(_mm256_castsi128_si256(low), high, 1);
+					}
+					transposeRegister(r);
+					for(std::size_t k = 0; k < n; ++k)
+						_mm256_storeu_si256(reinterpret_cast<__m256i*>(dstBlock + k*dstStep), r[k]);
+				}
+			}
+		}
+	};
+#endif
+
+	// full blocks in tiles of tileSize x tileSize with the block kernel, borders with the scalar copy
+	template<typename T, typename Block>
+	void transposeTiled(const T* src, std::size_t srcRowStride, T* dst, std::size_t dstRowStride, std::size_t rows, std::size_t cols)
+	{
+		const std::size_t fullRows = rows - rows % Block::blockRows;
+		const std::size_t fullCols = cols - cols % Block::blockCols;
+
+		const char* srcBytes = reinterpret_cast<const char*>(src);
+		      char* dstBytes = reinterpret_cast<      char*>(dst);
+		const std::size_t srcStep = srcRowStride*sizeof(T);
+		const std::size_t dstStep = dstRowStride*sizeof(T);
+
+		for(std::size_t ti = 0; ti < fullRows; ti += tileSize)
+		{
+			const std::size_t tileRows = std::min(tileSize, fullRows - ti);
+			for(std::size_t tj = 0; tj < fullCols; tj += tileSize)
+			{
+				const std::size_t tileCols = std::min(tileSize, fullCols - tj);
+				Block::transposeBlocks(srcBytes + ti*srcStep + tj*sizeof(T), srcStep
+				                     , dstBytes + tj*dstStep + ti*sizeof(T), dstStep
+				                     , tileRows, tileCols);
+			}
+		}
+
+		transposeScalar(src + fullCols               , srcRowStride, 1, dst + fullCols*dstRowStride, dstRowStride, 1, fullRows       , cols - fullCols);
+		transposeScalar(src + fullRows*srcRowStride  , srcRowStride, 1, dst + fullRows             , dstRowStride, 1, rows - fullRows, cols           );
+	}
+
+	template<typename T>
+	void transposeContinuousScalar(const T* src, std::size_t srcRowStride, T* dst, std::size_t dstRowStride, std::size_t rows, std::size_t cols)
+	{
+		transposeScalar(src, srcRowStride, 1, dst, dstRowStride, 1, rows, cols);
+	}
+
+	template<typename T>
+	using TransposeFunction = void(*)(const T*, std::size_t, T*, std::size_t, std::size_t, std::size_t);
+
+	template<typename T>
+	TransposeFunction<T> selectKernel()
+	{
+		static_assert(sizeof(T) == 1 || sizeof(T) == 2 || sizeof(T) == 4 || sizeof(T) == 8, "unsupported element size");
+#ifdef OCTDATA4MATLAB_AVX2
+		if(__builtin_cpu_supports("avx2"))
+			return &transposeTiled<T, BlockAVX2<sizeof(T)>>;
+#endif
+#ifdef OCTDATA4MATLAB_SSE2
+		return &transposeTiled<T, BlockSSE2<sizeof(T)>>;
+#else
+		return &transposeContinuousScalar<T>;
+#endif
+	}
+}
+
+
+template<typename T>
+void transposeCopy(const T* src, std::size_t srcRowStride, std::size_t srcPixStride
+                 ,       T* dst, std::size_t dstRowStride, std::size_t dstPixStride
+                 , std::size_t rows, std::size_t cols)
+{
+	if(srcPixStride == 1 && dstPixStride == 1)
+	{
+		static const TransposeKernel::TransposeFunction<T> kernel = TransposeKernel::selectKernel<T>();
+		kernel(src, srcRowStride, dst, dstRowStride, rows, cols);
+	}
+	else
+		TransposeKernel::transposeScalar(src, srcRowStride, srcPixStride, dst, dstRowStride, dstPixStride, rows, cols);
+}
+
+
+namespace TransposeKernel
+{
+	/*
+	 * Fused deinterleave / interleave of 3 channel pixels with the transpose, every source element is read once:
+	 *   deinterleave: dst[c][j*dstRowStride + i] = src[i*srcRowStride + j*srcPixStride + c]
+	 *   interleave:   dst[j*dstRowStride + 3*i + c] = src[c][i*srcRowStride + j]
+	 * for c = 0, 1, 2. 8 bit pixels with continuous rows use SSSE3 (pshufb) on 16 x 16 pixel blocks, everything else a cache blocked scalar copy.
+	 */
+	template<typename T>
+	void deinterleaveScalar(const T* src, std::size_t srcRowStride, std::size_t srcPixStride
+	                      , T* const* dst, std::size_t dstRowStride
+	                      , std::size_t rows, std::size_t cols)
+	{
+		constexpr std::size_t blockSize = sizeof(T) < 8 ? 64/sizeof(T) : 8;
+
+		for(std::size_t bi = 0; bi < rows; bi += blockSize)
+		{
+			const std::size_t biEnd = std::min(bi + blockSize, rows);
+			for(std::size_t bj = 0; bj < cols; bj += blockSize)
+			{
+				const std::size_t bjEnd = std::min(bj + blockSize, cols);
+				for(std::size_t i = bi; i < biEnd; ++i)
+				{
+					const T* srcIt = src + i*srcRowStride + bj*srcPixStride;
+					for(std::size_t j = bj; j < bjEnd; ++j)
+					{
+						const std::size_t dstPos = j*dstRowStride + i;
+						dst[0][dstPos] = srcIt[0];
+						dst[1][dstPos] = srcIt[1];
+						dst[2][dstPos] = srcIt[2];
+						srcIt += srcPixStride;
+					}
+				}
+			}
+		}
+	}
+
+	template<typename T>
+	void interleaveScalar(const T* const* src, std::size_t srcRowStride
+	                    , T* dst, std::size_t dstRowStride
+	                    , std::size_t rows, std::size_t cols)
+	{
+		constexpr std::size_t blockSize = sizeof(T) < 8 ? 64/sizeof(T) : 8;
+
+		for(std::size_t bi = 0; bi < rows; bi += blockSize)
+		{
+			const std::size_t biEnd = std::min(bi + blockSize, rows);
+			for(std::size_t bj = 0; bj < cols; bj += blockSize)
+			{
+				const std::size_t bjEnd = std::min(bj + blockSize, cols);
+				for(std::size_t i = bi; i < biEnd; ++i)
+				{
+					const std::size_t srcPos = i*srcRowStride;
+					for(std::size_t j = bj; j < bjEnd; ++j)
+					{
+						T* dstIt = dst + j*dstRowStride + 3*i;
+						dstIt[0] = src[0][srcPos + j];
+						dstIt[1] = src[1][srcPos + j];
+						dstIt[2] = src[2][srcPos + j];
+					}
+				}
+			}
+		}
+	}
+
+#ifdef OCTDATA4MATLAB_SSSE3
+	#define OCTDATA4MATLAB_TARGET_SSSE3 __attribute__((target("ssse3")))
+
+	// pshufb masks, byte k of 48 interleaved bytes (3 registers) <-> element k/3 of channel k%3, -128 clears the byte
+	struct Shuffle3Masks
+	{
+		__m128i split[3][3]; // [channel][source register]
+		__m128i merge[3][3]; // [destination register][channel]
+
+		Shuffle3Masks()
+		{
+			alignas(16) signed char mask[16];
+			for(int channel = 0; channel < 3; ++channel)
+				for(int reg = 0; reg < 3; ++reg)
+				{
+					for(int k = 0; k < 16; ++k)
+					{
+						const int pos = 3*k + channel - 16*reg;
+						mask[k] = static_cast<signed char>(pos >= 0 && pos < 16 ? pos : -128);
+					}
+					split[channel][reg] = _mm_load_si128(reinterpret_cast<const __m128i*>(mask));
+
+					for(int k = 0; k < 16; ++k)
+					{
+						const int pos = 16*reg + k;
+						mask[k] = static_cast<signed char>(pos % 3 == channel ? pos/3 : -128);
+					}
+					merge[reg][channel] = _mm_load_si128(reinterpret_cast<const __m128i*>(mask));
+				}
+		}
+
+		static const Shuffle3Masks& get()
+		{
+			static const Shuffle3Masks masks;
+			return masks;
+		}
+	};
+
+	// 16 rows x 16 pixels: 3 loads per source row, 16 stores per plane
+	OCTDATA4MATLAB_TARGET_SSSE3 inline void deinterleaveBlocksSSSE3(const char* src, std::size_t srcStep, char* const* dst, std::size_t dstStep, std::size_t rows, std::size_t cols)
+	{
+		const Shuffle3Masks& masks = Shuffle3Masks::get();
+		__m128i r[3][16];
+		for(std::size_t i = 0; i < rows; i += 16)
+		{
+			for(std::size_t j = 0; j < cols; j += 16)
+			{
+				const char* srcBlock = src + i*srcStep + 3*j;
+				for(std::size_t k = 0; k < 16; ++k)
+				{
+					const __m128i* srcRow = reinterpret_cast<const __m128i*>(srcBlock + k*srcStep);
+					const __m128i a = _mm_loadu_si128(srcRow    );
+					const __m128i b = _mm_loadu_si128(srcRow + 1);
+					const __m128i c = _mm_loadu_si128(srcRow + 2);
+					for(std::size_t channel = 0; channel < 3; ++channel)
+						r[channel][k] = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(a, masks.split[channel][0])
+						                                        , _mm_shuffle_epi8(b, masks.split[channel][1]))
+						                                        , _mm_shuffle_epi8(c, masks.split[channel][2]));
+				}
+				for(std::size_t channel = 0; channel < 3; ++channel)
+				{
+					BlockSSE2<1>::transposeRegister(r[channel]);
+					char* dstBlock = dst[channel] + j*dstStep + i;
+					for(std::size_t k = 0; k < 16; ++k)
+						_mm_storeu_si128(reinterpret_cast<__m128i*>(dstBlock + k*dstStep), r[channel][k]);
+				}
+			}
+		}
+	}
+
+	// 16 rows x 16 elements per plane: 16 loads per plane, 3 stores per destination row
+	OCTDATA4MATLAB_TARGET_SSSE3 inline void interleaveBlocksSSSE3(const char* const* src, std::size_t srcStep, char* dst, std::size_t dstStep, std::size_t rows, std::size_t cols)
+	{
+		const Shuffle3Masks& masks = Shuffle3Masks::get();
+		__m128i r[3][16];
+		for(std::size_t i = 0; i < rows; i += 16)
+		{
+			for(std::size_t j = 0; j < cols; j += 16)
+			{
+				for(std::size_t channel = 0; channel < 3; ++channel)
+				{
+					const char* srcBlock = src[channel] + i*srcStep + j;
+					for(std::size_t k = 0; k < 16; ++k)
+						r[channel][k] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(srcBlock + k*srcStep));
+					BlockSSE2<1>::transposeRegister(r[channel]);
+				}
+				char* dstBlock = dst + j*dstStep + 3*i;
+				for(std::size_t k = 0; k < 16; ++k)
+				{
+					__m128i* dstRow = reinterpret_cast<__m128i*>(dstBlock + k*dstStep);
+					for(std::size_t reg = 0; reg < 3; ++reg)
+						_mm_storeu_si128(dstRow + reg, _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(r[0][k], masks.merge[reg][0])
+						                                                       , _mm_shuffle_epi8(r[1][k], masks.merge[reg][1]))
+						                                                       , _mm_shuffle_epi8(r[2][k], masks.merge[reg][2])));
+				}
+			}
+		}
+	}
+
+	inline bool hasSSSE3()
+	{
+		static const bool supported = __builtin_cpu_supports("ssse3");
+		return supported;
+	}
+
+	// full 16 x 16 blocks in tiles of tileSize x tileSize with the SSSE3 kernel, borders with the scalar copy
+	inline void deinterleaveTiledSSSE3(const std::uint8_t* src, std::size_t srcRowStride, std::uint8_t* const* dst, std::size_t dstRowStride, std::size_t rows, std::size_t cols)
+	{
+		const std::size_t fullRows = rows - rows % 16;
+		const std::size_t fullCols = cols - cols % 16;
+
+		for(std::size_t ti = 0; ti < fullRows; ti += tileSize)
+		{
+			const std::size_t tileRows = std::min(tileSize, fullRows - ti);
+			for(std::size_t tj = 0; tj < fullCols; tj += tileSize)
+			{
+				char* const dstTile[] = { reinterpret_cast<char*>(dst[0] + tj*dstRowStride + ti)
+				                        , reinterpret_cast<char*>(dst[1] + tj*dstRowStride + ti)
+				                        , reinterpret_cast<char*>(dst[2] + tj*dstRowStride + ti) };
+				deinterleaveBlocksSSSE3(reinterpret_cast<const char*>(src + ti*srcRowStride + 3*tj), srcRowStride, dstTile, dstRowStride, tileRows, std::min(tileSize, fullCols - tj));
+			}
+		}
+
+		std::uint8_t* const dstRight [] = { dst[0] + fullCols*dstRowStride, dst[1] + fullCols*dstRowStride, dst[2] + fullCols*dstRowStride };
+		std::uint8_t* const dstBottom[] = { dst[0] + fullRows             , dst[1] + fullRows             , dst[2] + fullRows              };
+		deinterleaveScalar(src + 3*fullCols            , srcRowStride, 3, dstRight , dstRowStride, fullRows       , cols - fullCols);
+		deinterleaveScalar(src + fullRows*srcRowStride , srcRowStride, 3, dstBottom, dstRowStride, rows - fullRows, cols           );
+	}
+
+	inline void interleaveTiledSSSE3(const std::uint8_t* const* src, std::size_t srcRowStride, std::uint8_t* dst, std::size_t dstRowStride, std::size_t rows, std::size_t cols)
+	{
+		const std::size_t fullRows = rows - rows % 16;
+		const std::size_t fullCols = cols - cols % 16;
+
+		for(std::size_t ti = 0; ti < fullRows; ti += tileSize)
+		{
+			const std::size_t tileRows = std::min(tileSize, fullRows - ti);
+			for(std::size_t tj = 0; tj < fullCols; tj += tileSize)
+			{
+				const char* const srcTile[] = { reinterpret_cast<const char*>(src[0] + ti*srcRowStride + tj)
+				                              , reinterpret_cast<const char*>(src[1] + ti*srcRowStride + tj)
+				                              , reinterpret_cast<const char*>(src[2] + ti*srcRowStride + tj) };
+				interleaveBlocksSSSE3(srcTile, srcRowStride, reinterpret_cast<char*>(dst + tj*dstRowStride + 3*ti), dstRowStride, tileRows, std::min(tileSize, fullCols - tj));
+			}
+		}
+
+		const std::uint8_t* const srcRight [] = { src[0] + fullCols             , src[1] + fullCols             , src[2] + fullCols              };
+		const std::uint8_t* const srcBottom[] = { src[0] + fullRows*srcRowStride, src[1] + fullRows*srcRowStride, src[2] + fullRows*srcRowStride };
+		interleaveScalar(srcRight , srcRowStride, dst + fullCols*dstRowStride, dstRowStride, fullRows       , cols - fullCols);
+		interleaveScalar(srcBottom, srcRowStride, dst + 3*fullRows           , dstRowStride, rows - fullRows, cols           );
+	}
+#endif
+}
+
+
+// dst[c] are the three destination planes, e.g. the matlab planes r, g, b in the order of the opencv channels b, g, r
+template<typename T>
+void deinterleaveTransposeCopy(const T* src, std::size_t srcRowStride, std::size_t srcPixStride
+                             , T* const* dst, std::size_t dstRowStride
+                             , std::size_t rows, std::size_t cols)
+{
+#ifdef OCTDATA4MATLAB_SSSE3
+	if constexpr(sizeof(T) == 1)
+		if(srcPixStride == 3 && TransposeKernel::hasSSSE3())
+		{
+			std::uint8_t* const dstBytes[] = { reinterpret_cast<std::uint8_t*>(dst[0]), reinterpret_cast<std::uint8_t*>(dst[1]), reinterpret_cast<std::uint8_t*>(dst[2]) };
+			TransposeKernel::deinterleaveTiledSSSE3(reinterpret_cast<const std::uint8_t*>(src), srcRowStride, dstBytes, dstRowStride, rows, cols);
+			return;
+		}
+#endif
+	TransposeKernel::deinterleaveScalar(src, srcRowStride, srcPixStride, dst, dstRowStride, rows, cols);
+}
+
+template<typename T>
+void interleaveTransposeCopy(const T* const* src, std::size_t srcRowStride
+                           , T* dst, std::size_t dstRowStride
+                           , std::size_t rows, std::size_t cols)
+{
+#ifdef OCTDATA4MATLAB_SSSE3
+	if constexpr(sizeof(T) == 1)
+		if(TransposeKernel::hasSSSE3())
+		{
+			const std::uint8_t* const srcBytes[] = { reinterpret_cast<const std::uint8_t*>(src[0]), reinterpret_cast<const std::uint8_t*>(src[1]), reinterpret_cast<const std::uint8_t*>(src[2]) };
+			TransposeKernel::interleaveTiledSSSE3(srcBytes, srcRowStride, reinterpret_cast<std::uint8_t*>(dst), dstRowStride, rows, cols);
+			return;
+		}
+#endif
+	TransposeKernel::interleaveScalar(src, srcRowStride, dst, dstRowStride, rows, cols);
+}
@@ -0,0 +1,144 @@
+/*
+ * Copyright (c) 2018 Kay Gawlik <kaydev@amarunet.de> <kay.gawlik@beuth-hochschule.de> <kay.gawlik@charite.de>
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+/*
+ * Stand-in for the mex.h of MATLAB / Octave with the subset of the mx / mex API used by readoctdata and writeoctdata,
+ * implemented in mexstub.cpp (malloc backed, no MATLAB needed). Used by the benchmarks, not by the mex targets.
+ * Errors (mexErrMsgIdAndTxt) throw MexStub::Error instead of returning to the MATLAB prompt.
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
+typedef std::size_t    mwSize;
+typedef std::size_t    mwIndex;
+typedef std::ptrdiff_t mwSignedIndex;
+typedef char16_t       mxChar;
+typedef bool           mxLogical;
+
+struct mxArray;
+
+enum mxClassID
+{
+	mxUNKNOWN_CLASS,
+	mxCELL_CLASS,
+	mxSTRUCT_CLASS,
+	mxLOGICAL_CLASS,
+	mxCHAR_CLASS,
+	mxVOID_CLASS,
+	mxDOUBLE_CLASS,
+	mxSINGLE_CLASS,
+	mxINT8_CLASS,
+	mxUINT8_CLASS,
+	mxINT16_CLASS,
+	mxUINT16_CLASS,
+	mxINT32_CLASS,
+	mxUINT32_CLASS,
+	mxINT64_CLASS,
+	mxUINT64_CLASS,
+	mxFUNCTION_CLASS
+};
+
+enum mxComplexity { mxREAL, mxCOMPLEX };
+
+extern "C"
+{
+	mxArray* mxCreateNumericMatrix(mwSize m, mwSize n, mxClassID classID, mxComplexity complexity);
+	mxArray* mxCreateNumericArray (mwSize ndim, const mwSize* dims, mxClassID classID, mxComplexity complexity);
+	mxArray* mxCreateCharArray    (mwSize ndim, const mwSize* dims);
+	mxArray* mxCreateLogicalArray (mwSize ndim, const mwSize* dims);
+	mxArray* mxCreateCellMatrix   (mwSize m, mwSize n);
+	mxArray* mxCreateCellArray    (mwSize ndim, const mwSize* dims);
+	mxArray* mxCreateStructMatrix (mwSize m, mwSize n, int nfields, const char** fieldnames);
+	mxArray* mxCreateStructArray  (mwSize ndim, const mwSize* dims, int nfields, const char** fieldnames);
+	mxArray* mxCreateString       (const char* str);
+	mxArray* mxCreateDoubleScalar (double value);
+	void     mxDestroyArray       (mxArray* array);
+
+	mxClassID     mxGetClassID           (const mxArray* array);
+	void*         mxGetData              (const mxArray* array);
+	double*       mxGetPr                (const mxArray* array);
+	void          mxSetData              (mxArray* array, void* data);
+	mwSize        mxGetM                 (const mxArray* array);
+	mwSize        mxGetN                 (const mxArray* array);
+	void          mxSetM                 (mxArray* array, mwSize m);
+	void          mxSetN                 (mxArray* array, mwSize n);
+	mwSize        mxGetNumberOfDimensions(const mxArray* array);
+	const mwSize* mxGetDimensions        (const mxArray* array);
+	std::size_t   mxGetNumberOfElements  (const mxArray* array);
+	std::size_t   mxGetElementSize       (const mxArray* array);
+
+	bool mxIsChar   (const mxArray* array);
+	bool mxIsStruct (const mxArray* array);
+	bool mxIsCell   (const mxArray* array);
+	bool mxIsLogical(const mxArray* array);
+	bool mxIsNumeric(const mxArray* array);
+	bool mxIsEmpty  (const mxArray* array);
+
+	int         mxGetNumberOfFields   (const mxArray* array);
+	const char* mxGetFieldNameByNumber(const mxArray* array, int field);
+	mxArray*    mxGetField            (const mxArray* array, mwIndex index, const char* name);
+	mxArray*    mxGetFieldByNumber    (const mxArray* array, mwIndex index, int field);
+	void        mxSetField            (mxArray* array, mwIndex index, const char* name, mxArray* value);
+	void        mxSetFieldByNumber    (mxArray* array, mwIndex index, int field, mxArray* value);
+	int         mxAddField            (mxArray* array, const char* name);
+	mxArray*    mxGetCell             (const mxArray* array, mwIndex index);
+	void        mxSetCell             (mxArray* array, mwIndex index, mxArray* value);
+
+	void* mxMalloc(std::size_t size);
+	void* mxCalloc(std::size_t n, std::size_t size);
+	void  mxFree  (void* ptr);
+
+	int  mexPrintf        (const char* format, ...);
+	void mexErrMsgIdAndTxt(const char* id, const char* format, ...);
+	int  mexAtExit        (void (*func)(void));
+	void mexLock  ();
+	void mexUnlock();
+
+	// entry point of the mex file
+	void mexFunction(int nlhs, mxArray* plhs[], int nrhs, const mxArray* prhs[]);
+}
+
+
+namespace MexStub
+{
+	class Error : public std::runtime_error
+	{
+		std::string errorId;
+	public:
+		Error(const std::string& id, const std::string& message) : std::runtime_error(message), errorId(id) {}
+		const std::string& id() const { return errorId; }
+	};
+
+	// counted since the last resetStatistics(), from all threads
+	struct Statistics
+	{
+		std::uint64_t arrays    = 0; // mxCreate* calls
+		std::uint64_t dataBytes = 0; // bytes of the numeric and char data of these arrays
+		std::uint64_t mallocs   = 0; // mxMalloc / mxCalloc calls
+	};
+
+	Statistics getStatistics();
+	void       resetStatistics();
+
+	// calls the mexAtExit functions, as MATLAB does on clear mex
+	void unloadModule();
+}
@@ -0,0 +1,376 @@
+/*
+ * Copyright (c) 2018 Kay Gawlik <kaydev@amarunet.de> <kay.gawlik@beuth-hochschule.de> <kay.gawlik@charite.de>
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mex.h"
+
+#include <atomic>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <new>
+#include <vector>
+
+
+struct mxArray
+{
+	mxClassID                classID = mxUNKNOWN_CLASS;
+	std::vector<mwSize>      dims;       // at least 2, trailing singleton dimensions removed
+	void*                    data = nullptr; // numeric and char arrays, allocated with mxCalloc
+	std::vector<std::string> fieldNames; // struct
+	std::vector<mxArray*>    children;   // cell: numel, struct: numel*numFields (element major)
+};
+
+
+namespace
+{
+	std::atomic<std::uint64_t> countArrays   (0);
+	std::atomic<std::uint64_t> countDataBytes(0);
+	std::atomic<std::uint64_t> countMallocs  (0);
+
+	std::vector<void (*)(void)> exitFunctions;
+
+	std::size_t getElementSize(mxClassID classID)
+	{
+		switch(classID)
+		{
+			case mxLOGICAL_CLASS:
+			case mxINT8_CLASS:
+			case mxUINT8_CLASS:
+				return 1;
+			case mxCHAR_CLASS:
+			case mxINT16_CLASS:
+			case mxUINT16_CLASS:
+				return 2;
+			case mxSINGLE_CLASS:
+			case mxINT32_CLASS:
+			case mxUINT32_CLASS:
+				return 4;
+			case mxDOUBLE_CLASS:
+			case mxINT64_CLASS:
+			case mxUINT64_CLASS:
+				return 8;
+			default:
+				return sizeof(mxArray*);
+		}
+	}
+
+	std::size_t getNumElements(const std::vector<mwSize>& dims)
+	{
+		std::size_t numel = 1;
+		for(mwSize dim : dims)
+		{
+			if(dim != 0 && numel > std::numeric_limits<std::size_t>::max()/dim)
+				throw MexStub::Error("MATLAB:array:SizeLimitExceeded", "Requested array exceeds the maximum possible array size");
+			numel *= dim;
+		}
+		return numel;
+	}
+
+	mxArray* createArray(mxClassID classID, mwSize ndim, const mwSize* dims)
+	{
+		mxArray* array = new mxArray;
+		array->classID = classID;
+		array->dims.assign(dims, dims + ndim);
+		while(array->dims.size() > 2 && array->dims.back() == 1)
+			array->dims.pop_back();
+		if(array->dims.size() < 2)
+			array->dims.resize(2, 1);
+
+		++countArrays;
+		return array;
+	}
+
+	int getFieldNumber(const mxArray* array, const char* name)
+	{
+		for(std::size_t i = 0; i < array->fieldNames.size(); ++i)
+			if(array->fieldNames[i] == name)
+				return static_cast<int>(i);
+		return -1;
+	}
+
+	mxArray*& getChild(const mxArray* array, mwIndex index, int field)
+	{
+		const std::size_t numFields = array->classID == mxSTRUCT_CLASS ? array->fieldNames.size() : 1;
+		const std::size_t pos       = index*numFields + static_cast<std::size_t>(field);
+		if(pos >= array->children.size())
+			throw MexStub::Error("MexStub:index", "index exceeds array bounds");
+		return const_cast<mxArray*&>(array->children[pos]);
+	}
+}
+
+
+extern "C"
+{
+	mxArray* mxCreateNumericArray(mwSize ndim, const mwSize* dims, mxClassID classID, mxComplexity /*complexity*/)
+	{
+		// size check before the allocation, no leaked array if it throws
+		const std::size_t numel    = getNumElements(std::vector<mwSize>(dims, dims + ndim));
+		const std::size_t elemSize = getElementSize(classID);
+		mxArray* array = createArray(classID, ndim, dims);
+		array->data = mxCalloc(numel > 0 ? numel : 1, elemSize);
+		countDataBytes += numel*elemSize;
+		return array;
+	}
+
+	mxArray* mxCreateNumericMatrix(mwSize m, mwSize n, mxClassID classID, mxComplexity complexity)
+	{
+		const mwSize dims[] = { m, n };
+		return mxCreateNumericArray(2, dims, classID, complexity);
+	}
+
+	mxArray* mxCreateCharArray(mwSize ndim, const mwSize* dims)
+	{
+		return mxCreateNumericArray(ndim, dims, mxCHAR_CLASS, mxREAL);
+	}
+
+	mxArray* mxCreateLogicalArray(mwSize ndim, const mwSize* dims)
+	{
+		return mxCreateNumericArray(ndim, dims, mxLOGICAL_CLASS, mxREAL);
+	}
+
+	mxArray* mxCreateCellArray(mwSize ndim, const mwSize* dims)
+	{
+		mxArray* array = createArray(mxCELL_CLASS, ndim, dims);
+		array->children.assign(getNumElements(array->dims), nullptr);
+		return array;
+	}
+
+	mxArray* mxCreateCellMatrix(mwSize m, mwSize n)
+	{
+		const mwSize dims[] = { m, n };
+		return mxCreateCellArray(2, dims);
+	}
+
+	mxArray* mxCreateStructArray(mwSize ndim, const mwSize* dims, int nfields, const char** fieldnames)
+	{
+		mxArray* array = createArray(mxSTRUCT_CLASS, ndim, dims);
+		for(int i = 0; i < nfields; ++i)
+			array->fieldNames.emplace_back(fieldnames[i]);
+		array->children.assign(getNumElements(array->dims)*static_cast<std::size_t>(nfields), nullptr);
+		return array;
+	}
+
+	mxArray* mxCreateStructMatrix(mwSize m, mwSize n, int nfields, const char** fieldnames)
+	{
+		const mwSize dims[] = { m, n };
+		return mxCreateStructArray(2, dims, nfields, fieldnames);
+	}
+
+	mxArray* mxCreateString(const char* str)
+	{
+		const std::size_t length = std::strlen(str);
+		mxArray* array = mxCreateNumericMatrix(length > 0 ? 1 : 0, length, mxCHAR_CLASS, mxREAL);
+		mxChar* data = static_cast<mxChar*>(array->data);
+		for(std::size_t i = 0; i < length; ++i)
+			data[i] = static_cast<mxChar>(static_cast<unsigned char>(str[i]));
+		return array;
+	}
+
+	mxArray* mxCreateDoubleScalar(double value)
+	{
+		mxArray* array = mxCreateNumericMatrix(1, 1, mxDOUBLE_CLASS, mxREAL);
+		*static_cast<double*>(array->data) = value;
+		return array;
+	}
+
+	void mxDestroyArray(mxArray* array)
+	{
+		if(!array)
+			return;
+		for(mxArray* child : array->children)
+			mxDestroyArray(child);
+		mxFree(array->data);
+		delete array;
+	}
+
+
+	mxClassID     mxGetClassID           (const mxArray* array) { return array->classID; }
+	void*         mxGetData              (const mxArray* array) { return array->data; }
+	double*       mxGetPr                (const mxArray* array) { return static_cast<double*>(array->data); }
+	void          mxSetData              (mxArray* array, void* data) { array->data = data; }
+	mwSize        mxGetM                 (const mxArray* array) { return array->dims[0]; }
+	void          mxSetM                 (mxArray* array, mwSize m) { array->dims[0] = m; }
+	void          mxSetN                 (mxArray* array, mwSize n) { array->dims.resize(2); array->dims[1] = n; }
+	mwSize        mxGetNumberOfDimensions(const mxArray* array) { return array->dims.size(); }
+	const mwSize* mxGetDimensions        (const mxArray* array) { return array->dims.data(); }
+	std::size_t   mxGetNumberOfElements  (const mxArray* array) { return getNumElements(array->dims); }
+	std::size_t   mxGetElementSize       (const mxArray* array) { return getElementSize(array->classID); }
+
+	bool mxIsChar   (const mxArray* array) { return array->classID == mxCHAR_CLASS;    }
+	bool mxIsStruct (const mxArray* array) { return array->classID == mxSTRUCT_CLASS;  }
+	bool mxIsCell   (const mxArray* array) { return array->classID == mxCELL_CLASS;    }
+	bool mxIsLogical(const mxArray* array) { return array->classID == mxLOGICAL_CLASS; }
+	bool mxIsNumeric(const mxArray* array) { return array->classID >= mxDOUBLE_CLASS && array->classID <= mxUINT64_CLASS; }
+	bool mxIsEmpty  (const mxArray* array) { return getNumElements(array->dims) == 0; }
+
+
+	mwSize mxGetN(const mxArray* array)
+	{
+		std::size_t n = 1;
+		for(std::size_t i = 1; i < array->dims.size(); ++i)
+			n *= array->dims[i];
+		return n;
+	}
+
+	int mxGetNumberOfFields(const mxArray* array)
+	{
+		return static_cast<int>(array->fieldNames.size());
+	}
+
+	const char* mxGetFieldNameByNumber(const mxArray* array, int field)
+	{
+		if(field < 0 || static_cast<std::size_t>(field) >= array->fieldNames.size())
+			return nullptr;
+		return array->fieldNames[static_cast<std::size_t>(field)].c_str();
+	}
+
+	mxArray* mxGetField(const mxArray* array, mwIndex index, const char* name)
+	{
+		if(!array || array->classID != mxSTRUCT_CLASS)
+			return nullptr;
+		const int field = getFieldNumber(array, name);
+		return field < 0 ? nullptr : getChild(array, index, field);
+	}
+
+	mxArray* mxGetFieldByNumber(const mxArray* array, mwIndex index, int field)
+	{
+		return getChild(array, index, field);
+	}
+
+	void mxSetFieldByNumber(mxArray* array, mwIndex index, int field, mxArray* value)
+	{
+		getChild(array, index, field) = value;
+	}
+
+	int mxAddField(mxArray* array, const char* name)
+	{
+		const std::size_t numel     = getNumElements(array->dims);
+		const std::size_t numFields = array->fieldNames.size();
+
+		std::vector<mxArray*> children;
+		children.reserve(numel*(numFields + 1));
+		for(std::size_t i = 0; i < numel; ++i)
+		{
+			children.insert(children.end(), array->children.begin() + static_cast<std::ptrdiff_t>(i*numFields), array->children.begin() + static_cast<std::ptrdiff_t>((i + 1)*numFields));
+			children.push_back(nullptr);
+		}
+		array->children.swap(children);
+		array->fieldNames.emplace_back(name);
+		return static_cast<int>(numFields);
+	}
+
+	void mxSetField(mxArray* array, mwIndex index, const char* name, mxArray* value)
+	{
+		int field = getFieldNumber(array, name);
+		if(field < 0)
+			field = mxAddField(array, name);
+		mxSetFieldByNumber(array, index, field, value);
+	}
+
+	mxArray* mxGetCell(const mxArray* array, mwIndex index)
+	{
+		return getChild(array, index, 0);
+	}
+
+	void mxSetCell(mxArray* array, mwIndex index, mxArray* value)
+	{
+		getChild(array, index, 0) = value;
+	}
+
+
+	void* mxMalloc(std::size_t size)
+	{
+		++countMallocs;
+		void* ptr = std::malloc(size > 0 ? size : 1);
+		if(!ptr)
+			throw std::bad_alloc();
+		return ptr;
+	}
+
+	void* mxCalloc(std::size_t n, std::size_t size)
+	{
+		++countMallocs;
+		void* ptr = std::calloc(n > 0 ? n : 1, size > 0 ? size : 1);
+		if(!ptr)
+			throw std::bad_alloc();
+		return ptr;
+	}
+
+	void mxFree(void* ptr)
+	{
+		std::free(ptr);
+	}
+
+
+	int mexPrintf(const char* format, ...)
+	{
+		va_list args;
+		va_start(args, format);
+		const int result = std::vprintf(format, args);
+		va_end(args);
+		return result;
+	}
+
+	void mexErrMsgIdAndTxt(const char* id, const char* format, ...)
+	{
+		char message[1024];
+		va_list args;
+		va_start(args, format);
+		std::vsnprintf(message, sizeof(message), format, args);
+		va_end(args);
+		throw MexStub::Error(id, message);
+	}
+
+	int mexAtExit(void (*func)(void))
+	{
+		exitFunctions.push_back(func);
+		return 0;
+	}
+
+	void mexLock  () {}
+	void mexUnlock() {}
+}
+
+
+namespace MexStub
+{
+	Statistics getStatistics()
+	{
+		Statistics stat;
+		stat.arrays    = countArrays;
+		stat.dataBytes = countDataBytes;
+		stat.mallocs   = countMallocs;
+		return stat;
+	}
+
+	void resetStatistics()
+	{
+		countArrays    = 0;
+		countDataBytes = 0;
+		countMallocs   = 0;
+	}
+
+	void unloadModule()
+	{
+		std::vector<void (*)(void)> functions;
+		functions.swap(exitFunctions);
+		for(void (*func)(void) : functions)
+			func();
+	}
+}
@@ -0,0 +1,475 @@
+/*
+ * Copyright (c) 2018 Kay Gawlik <kaydev@amarunet.de> <kay.gawlik@beuth-hochschule.de> <kay.gawlik@charite.de>
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mat73_writer.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include <hdf5.h>
+#include <zlib.h>
+
+
+namespace
+{
+	constexpr std::uint64_t chunkMinBytes    = 64*1024;
+	constexpr std::uint64_t chunkTargetBytes = 1024*1024;
+	constexpr std::size_t   userBlockSize    = 512;
+
+	std::mutex& getHdf5Mutex()
+	{
+		static std::mutex mutex;
+		return mutex;
+	}
+
+	// closes an HDF5 id at the end of the scope
+	class Handle
+	{
+		hid_t  id;
+		herr_t (*close)(hid_t);
+	public:
+		Handle(hid_t id, herr_t (*close)(hid_t)) : id(id), close(close) {}
+		~Handle()
+		{
+			if(id >= 0)
+				close(id);
+		}
+
+		Handle(const Handle&) = delete;
+		Handle& operator=(const Handle&) = delete;
+
+		operator hid_t() const { return id; }
+		bool valid()     const { return id >= 0; }
+	};
+
+	const char* getClassName(mxClassID classID)
+	{
+		switch(classID)
+		{
+			case mxDOUBLE_CLASS : return "double" ;
+			case mxSINGLE_CLASS : return "single" ;
+			case mxINT8_CLASS   : return "int8"   ;
+			case mxUINT8_CLASS  : return "uint8"  ;
+			case mxINT16_CLASS  : return "int16"  ;
+			case mxUINT16_CLASS : return "uint16" ;
+			case mxINT32_CLASS  : return "int32"  ;
+			case mxUINT32_CLASS : return "uint32" ;
+			case mxINT64_CLASS  : return "int64"  ;
+			case mxUINT64_CLASS : return "uint64" ;
+			case mxCHAR_CLASS   : return "char"   ;
+			case mxLOGICAL_CLASS: return "logical";
+			case mxCELL_CLASS   : return "cell"   ;
+			case mxSTRUCT_CLASS : return "struct" ;
+			default:
+				return nullptr;
+		}
+	}
+
+	hid_t getNativeType(mxClassID classID)
+	{
+		switch(classID)
+		{
+			case mxDOUBLE_CLASS : return H5T_NATIVE_DOUBLE;
+			case mxSINGLE_CLASS : return H5T_NATIVE_FLOAT ;
+			case mxINT8_CLASS   : return H5T_NATIVE_INT8  ;
+			case mxUINT8_CLASS  : return H5T_NATIVE_UINT8 ;
+			case mxINT16_CLASS  : return H5T_NATIVE_INT16 ;
+			case mxUINT16_CLASS : return H5T_NATIVE_UINT16;
+			case mxINT32_CLASS  : return H5T_NATIVE_INT32 ;
+			case mxUINT32_CLASS : return H5T_NATIVE_UINT32;
+			case mxINT64_CLASS  : return H5T_NATIVE_INT64 ;
+			case mxUINT64_CLASS : return H5T_NATIVE_UINT64;
+			case mxCHAR_CLASS   : return H5T_NATIVE_UINT16; // mxChar, UTF-16
+			case mxLOGICAL_CLASS: return H5T_NATIVE_UINT8 ;
+			default:
+				return -1;
+		}
+	}
+
+	// HDF5 is row-major, the reversed dimensions give the column-major layout of matlab
+	std::vector<hsize_t> getHdf5Dims(const mxArray* matlabMat)
+	{
+		const mwSize  ndims = mxGetNumberOfDimensions(matlabMat);
+		const mwSize* dims  = mxGetDimensions(matlabMat);
+		std::vector<hsize_t> hdims(ndims);
+		for(mwSize d = 0; d < ndims; ++d)
+			hdims[ndims - 1 - d] = static_cast<hsize_t>(dims[d]);
+		return hdims;
+	}
+
+
+	// chunks of one dataset, compressed before the HDF5 mutex is taken
+	struct CompressedArray
+	{
+		std::vector<hsize_t>                   chunkDims;
+		std::vector<std::vector<std::uint8_t>> chunks;
+	};
+
+	typedef std::map<const mxArray*, CompressedArray> CompressedArrays;
+
+	bool isChunked(const mxArray* matlabMat, int compression)
+	{
+		return compression > 0
+		    && (mxIsNumeric(matlabMat) || mxIsLogical(matlabMat))
+		    && static_cast<std::uint64_t>(mxGetNumberOfElements(matlabMat))*mxGetElementSize(matlabMat) >= chunkMinBytes;
+	}
+
+	// a chunk is a range of the first HDF5 dimension (last matlab dimension), so it is a contiguous part of the matlab data
+	bool compressArray(const mxArray* matlabMat, int compression, CompressedArray& compressed)
+	{
+		const std::vector<hsize_t> dims       = getHdf5Dims(matlabMat);
+		const std::uint64_t        numBytes   = static_cast<std::uint64_t>(mxGetNumberOfElements(matlabMat))*mxGetElementSize(matlabMat);
+		const std::uint64_t        sliceBytes = numBytes/dims[0];
+		const std::uint64_t        sliceCount = std::min<std::uint64_t>(std::max<std::uint64_t>(chunkTargetBytes/sliceBytes, 1), dims[0]);
+		const std::uint64_t        chunkBytes = sliceCount*sliceBytes;
+
+		compressed.chunkDims    = dims;
+		compressed.chunkDims[0] = sliceCount;
+
+		const std::uint8_t* data = static_cast<const std::uint8_t*>(mxGetData(matlabMat));
+		std::vector<std::uint8_t> padded;
+		for(std::uint64_t offset = 0; offset < numBytes; offset += chunkBytes)
+		{
+			const std::uint8_t* chunk = data + offset;
+			if(numBytes - offset < chunkBytes) // the edge chunk has the full chunk size in the file
+			{
+				padded.assign(chunkBytes, 0);
+				std::memcpy(padded.data(), chunk, static_cast<std::size_t>(numBytes - offset));
+				chunk = padded.data();
+			}
+
+			uLongf size = compressBound(static_cast<uLong>(chunkBytes));
+			std::vector<std::uint8_t> buffer(size);
+			if(compress2(buffer.data(), &size, chunk, static_cast<uLong>(chunkBytes), compression) != Z_OK)
+				return false;
+			buffer.resize(size);
+			compressed.chunks.push_back(std::move(buffer));
+		}
+		return true;
+	}
+
+	bool compressArrays(const mxArray* matlabMat, int compression, CompressedArrays& compressed)
+	{
+		if(!matlabMat)
+			return true;
+
+		const std::size_t numel = mxGetNumberOfElements(matlabMat);
+		if(mxIsStruct(matlabMat))
+		{
+			const int numFields = mxGetNumberOfFields(matlabMat);
+			for(std::size_t i = 0; i < numel; ++i)
+				for(int field = 0; field < numFields; ++field)
+					if(!compressArrays(mxGetFieldByNumber(matlabMat, static_cast<mwIndex>(i), field), compression, compressed))
+						return false;
+			return true;
+		}
+		if(mxIsCell(matlabMat))
+		{
+			for(std::size_t i = 0; i < numel; ++i)
+				if(!compressArrays(mxGetCell(matlabMat, static_cast<mwIndex>(i)), compression, compressed))
+					return false;
+			return true;
+		}
+		if(isChunked(matlabMat, compression))
+			return compressArray(matlabMat, compression, compressed[matlabMat]);
+		return true;
+	}
+
+
+	// writes the matlab structure with the HDF5 mutex locked
+	class FileWriter
+	{
+		hid_t                   file;
+		const CompressedArrays& compressed;
+		int                     compression;
+		std::size_t             numRefs = 0;
+
+		static bool writeStringAttribute(hid_t object, const char* name, const char* value)
+		{
+			Handle type (H5Tcopy(H5T_C_S1), H5Tclose);
+			H5Tset_size(type, std::strlen(value));
+			Handle space(H5Screate(H5S_SCALAR), H5Sclose);
+			Handle attr (H5Acreate2(object, name, type, space, H5P_DEFAULT, H5P_DEFAULT), H5Aclose);
+			return attr.valid() && H5Awrite(attr, type, value) >= 0;
+		}
+
+		template<typename T>
+		static bool writeScalarAttribute(hid_t object, const char* name, hid_t type, T value)
+		{
+			Handle space(H5Screate(H5S_SCALAR), H5Sclose);
+			Handle attr (H5Acreate2(object, name, type, space, H5P_DEFAULT, H5P_DEFAULT), H5Aclose);
+			return attr.valid() && H5Awrite(attr, type, &value) >= 0;
+		}
+
+		static bool writeClassAttributes(hid_t object, mxClassID classID)
+		{
+			if(!writeStringAttribute(object, "MATLAB_class", getClassName(classID)))
+				return false;
+			if(classID == mxCHAR_CLASS)
+				return writeScalarAttribute<std::int32_t>(object, "MATLAB_int_decode", H5T_NATIVE_INT32, 2);
+			if(classID == mxLOGICAL_CLASS)
+				return writeScalarAttribute<std::int32_t>(object, "MATLAB_int_decode", H5T_NATIVE_INT32, 1);
+			return true;
+		}
+
+		// field order of a struct, variable length strings of single characters as written by matlab
+		static bool writeFieldsAttribute(hid_t group, const mxArray* matlabStruct)
+		{
+			const int numFields = mxGetNumberOfFields(matlabStruct);
+			if(numFields == 0)
+				return true;
+
+			std::vector<hvl_t> names(static_cast<std::size_t>(numFields));
+			for(int field = 0; field < numFields; ++field)
+			{
+				const char* name = mxGetFieldNameByNumber(matlabStruct, field);
+				names[static_cast<std::size_t>(field)].len = std::strlen(name);
+				names[static_cast<std::size_t>(field)].p   = const_cast<char*>(name);
+			}
+
+			Handle charType(H5Tcopy(H5T_C_S1), H5Tclose);
+			H5Tset_size(charType, 1);
+			Handle type (H5Tvlen_create(charType), H5Tclose);
+			const hsize_t size = names.size();
+			Handle space(H5Screate_simple(1, &size, nullptr), H5Sclose);
+			Handle attr (H5Acreate2(group, "MATLAB_fields", type, space, H5P_DEFAULT, H5P_DEFAULT), H5Aclose);
+			return attr.valid() && H5Awrite(attr, type, names.data()) >= 0;
+		}
+
+		// empty arrays: the dimensions as data and MATLAB_empty
+		static bool writeEmpty(hid_t parent, const char* name, const mxArray* matlabMat)
+		{
+			mxClassID classID = mxDOUBLE_CLASS;
+			std::vector<std::uint64_t> dims(2, 0);
+			if(matlabMat)
+			{
+				classID = mxGetClassID(matlabMat);
+				const mwSize  ndims    = mxGetNumberOfDimensions(matlabMat);
+				const mwSize* mxDims   = mxGetDimensions(matlabMat);
+				dims.assign(mxDims, mxDims + ndims);
+			}
+
+			const hsize_t size = dims.size();
+			Handle space(H5Screate_simple(1, &size, nullptr), H5Sclose);
+			Handle dataset(H5Dcreate2(parent, name, H5T_NATIVE_UINT64, space, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT), H5Dclose);
+			return dataset.valid()
+			    && H5Dwrite(dataset, H5T_NATIVE_UINT64, H5S_ALL, H5S_ALL, H5P_DEFAULT, dims.data()) >= 0
+			    && writeClassAttributes(dataset, classID)
+			    && writeScalarAttribute<std::uint8_t>(dataset, "MATLAB_empty", H5T_NATIVE_UINT8, 1);
+		}
+
+		bool writeArray(hid_t parent, const char* name, const mxArray* matlabMat)
+		{
+			const mxClassID            classID = mxGetClassID(matlabMat);
+			const std::vector<hsize_t> dims    = getHdf5Dims(matlabMat);
+			const hid_t                type    = getNativeType(classID);
+
+			Handle space(H5Screate_simple(static_cast<int>(dims.size()), dims.data(), nullptr), H5Sclose);
+			Handle dcpl (H5Pcreate(H5P_DATASET_CREATE), H5Pclose);
+
+			const CompressedArrays::const_iterator it = compressed.find(matlabMat);
+			if(it != compressed.end())
+			{
+				H5Pset_chunk(dcpl, static_cast<int>(it->second.chunkDims.size()), it->second.chunkDims.data());
+				H5Pset_deflate(dcpl, static_cast<unsigned int>(compression)); // the chunks are already compressed, the filter is for the readers
+			}
+
+			Handle dataset(H5Dcreate2(parent, name, type, space, H5P_DEFAULT, dcpl, H5P_DEFAULT), H5Dclose);
+			if(!dataset.valid() || !writeClassAttributes(dataset, classID))
+				return false;
+
+			if(it == compressed.end())
+				return H5Dwrite(dataset, type, H5S_ALL, H5S_ALL, H5P_DEFAULT, mxGetData(matlabMat)) >= 0;
+
+			std::vector<hsize_t> offset(dims.size(), 0);
+			for(const std::vector<std::uint8_t>& chunk : it->second.chunks)
+			{
+				if(H5Dwrite_chunk(dataset, H5P_DEFAULT, 0, offset.data(), chunk.size(), chunk.data()) < 0)
+					return false;
+				offset[0] += it->second.chunkDims[0];
+			}
+			return true;
+		}
+
+		// element major array of references to the objects in /#refs#
+		bool writeReferences(hid_t parent, const char* name, const std::vector<const mxArray*>& elements, const mxArray* shape, mxClassID classID)
+		{
+			Handle refs(H5Lexists(file, "/#refs#", H5P_DEFAULT) > 0 ? H5Gopen2(file, "/#refs#", H5P_DEFAULT)
+			                                                         : H5Gcreate2(file, "/#refs#", H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT), H5Gclose);
+			if(!refs.valid())
+				return false;
+
+			std::vector<hobj_ref_t> references(elements.size());
+			for(std::size_t i = 0; i < elements.size(); ++i)
+			{
+				const std::string refName = getRefName(numRefs++);
+				if(!writeObject(refs, refName.c_str(), elements[i]))
+					return false;
+				const std::string path = "/#refs#/" + refName;
+				if(H5Rcreate(&references[i], file, path.c_str(), H5R_OBJECT, -1) < 0)
+					return false;
+			}
+
+			const std::vector<hsize_t> dims = getHdf5Dims(shape);
+			Handle space  (H5Screate_simple(static_cast<int>(dims.size()), dims.data(), nullptr), H5Sclose);
+			Handle dataset(H5Dcreate2(parent, name, H5T_STD_REF_OBJ, space, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT), H5Dclose);
+			return dataset.valid()
+			    && H5Dwrite(dataset, H5T_STD_REF_OBJ, H5S_ALL, H5S_ALL, H5P_DEFAULT, references.data()) >= 0
+			    && writeClassAttributes(dataset, classID);
+		}
+
+		// a, b, ..., z, ba, bb, ...
+		static std::string getRefName(std::size_t index)
+		{
+			std::string name;
+			do
+			{
+				name.insert(name.begin(), static_cast<char>('a' + index%26));
+				index /= 26;
+			}
+			while(index > 0);
+			return name;
+		}
+
+		bool writeStruct(hid_t parent, const char* name, const mxArray* matlabStruct)
+		{
+			Handle group(H5Gcreate2(parent, name, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT), H5Gclose);
+			if(!group.valid() || !writeClassAttributes(group, mxSTRUCT_CLASS) || !writeFieldsAttribute(group, matlabStruct))
+				return false;
+
+			const int         numFields = mxGetNumberOfFields(matlabStruct);
+			const std::size_t numel     = mxGetNumberOfElements(matlabStruct);
+			for(int field = 0; field < numFields; ++field)
+			{
+				const char* fieldName = mxGetFieldNameByNumber(matlabStruct, field);
+				if(numel == 1)
+				{
+					if(!writeObject(group, fieldName, mxGetFieldByNumber(matlabStruct, 0, field)))
+						return false;
+					continue;
+				}
+
+				// struct array: every field is an array of references with the size of the struct
+				std::vector<const mxArray*> elements(numel);
+				for(std::size_t i = 0; i < numel; ++i)
+					elements[i] = mxGetFieldByNumber(matlabStruct, static_cast<mwIndex>(i), field);
+				if(!writeReferences(group, fieldName, elements, matlabStruct, mxCELL_CLASS))
+					return false;
+			}
+			return true;
+		}
+
+	public:
+		FileWriter(hid_t file, const CompressedArrays& compressed, int compression) : file(file), compressed(compressed), compression(compression) {}
+
+		// missing values (nullptr) are written as [] like matlab shows them
+		bool writeObject(hid_t parent, const char* name, const mxArray* matlabMat)
+		{
+			if(!matlabMat || mxIsEmpty(matlabMat))
+				return writeEmpty(parent, name, matlabMat);
+
+			if(mxIsStruct(matlabMat))
+				return writeStruct(parent, name, matlabMat);
+
+			if(mxIsCell(matlabMat))
+			{
+				std::vector<const mxArray*> elements(mxGetNumberOfElements(matlabMat));
+				for(std::size_t i = 0; i < elements.size(); ++i)
+					elements[i] = mxGetCell(matlabMat, static_cast<mwIndex>(i));
+				return writeReferences(parent, name, elements, matlabMat, mxCELL_CLASS);
+			}
+
+			if(getNativeType(mxGetClassID(matlabMat)) < 0)
+				return false;
+			return writeArray(parent, name, matlabMat);
+		}
+	};
+
+	// the text header of a MAT file in the HDF5 user block, version 0x0200 and endian indicator
+	bool writeMatHeader(const std::string& filename)
+	{
+		char header[userBlockSize] = {};
+		const std::time_t now = std::time(nullptr);
+		char date[64];
+		std::strftime(date, sizeof(date), "%a %b %d %H:%M:%S %Y", std::localtime(&now));
+
+		std::memset(header, ' ', 116);
+		const int length = std::snprintf(header, 116, "MATLAB 7.3 MAT-file, Platform: octdata2mat, Created on: %s HDF5 schema 1.00 .", date);
+		if(length > 0 && length < 116)
+			header[length] = ' ';
+		std::memset(header + 116, 0, 8);  // subsystem data offset
+		const std::uint16_t version = 0x0200;
+		std::memcpy(header + 124, &version, sizeof(version));
+		header[126] = 'I';
+		header[127] = 'M';
+
+		std::FILE* file = std::fopen(filename.c_str(), "r+b");
+		if(!file)
+			return false;
+		const bool success = std::fwrite(header, 1, sizeof(header), file) == sizeof(header);
+		return std::fclose(file) == 0 && success;
+	}
+}
+
+
+namespace Mat73
+{
+	bool writeFile(const std::string& filename, const std::string& variableName, const mxArray* data, int compression, std::string& error)
+	{
+		compression = std::max(0, std::min(compression, 9));
+
+		CompressedArrays compressed;
+		if(!compressArrays(data, compression, compressed))
+		{
+			error = "compression failed";
+			return false;
+		}
+
+		std::lock_guard<std::mutex> lock(getHdf5Mutex()); // also for localtime in writeMatHeader
+		H5Eset_auto2(H5E_DEFAULT, nullptr, nullptr);
+		{
+			Handle fcpl(H5Pcreate(H5P_FILE_CREATE), H5Pclose);
+			H5Pset_userblock(fcpl, userBlockSize);
+			Handle file(H5Fcreate(filename.c_str(), H5F_ACC_TRUNC, fcpl, H5P_DEFAULT), H5Fclose);
+			if(!file.valid())
+			{
+				error = "can not create " + filename;
+				return false;
+			}
+
+			FileWriter writer(file, compressed, compression);
+			if(!writer.writeObject(file, variableName.c_str(), data))
+			{
+				error = "HDF5 write failed";
+				return false;
+			}
+		}
+
+		if(!writeMatHeader(filename))
+		{
+			error = "can not write the MAT header";
+			return false;
+		}
+		return true;
+	}
+}
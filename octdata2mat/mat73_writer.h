@@ -0,0 +1,37 @@
+/*
+ * Copyright (c) 2018 Kay Gawlik <kaydev@amarunet.de> <kay.gawlik@beuth-hochschule.de> <kay.gawlik@charite.de>
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <string>
+
+#include <mex.h>
+
+
+/*
+ * MATLAB 7.3 MAT files (HDF5 with a 512 byte MATLAB header), readable with load and h5read.
+ *
+ * structs are groups, cells datasets of object references into /#refs#, numeric arrays of at least chunkMinBytes are
+ * chunked along their last dimension (e.g. the B-scans of a volume) and deflate compressed.
+ * The chunks are compressed in the calling thread, all HDF5 calls are serialized by one mutex (the library is not thread safe),
+ * so several files can be written in parallel.
+ */
+namespace Mat73
+{
+	// compression 0 (contiguous datasets) .. 9, false and error message on failure
+	bool writeFile(const std::string& filename, const std::string& variableName, const mxArray* data, int compression, std::string& error);
+}
@@ -0,0 +1,212 @@
+/*
+ * Copyright (c) 2018 Kay Gawlik <kaydev@amarunet.de> <kay.gawlik@beuth-hochschule.de> <kay.gawlik@charite.de>
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * octdata2mat: converts OCT files to MATLAB 7.3 MAT files without MATLAB.
+ * The structure is created by the conversion code of readoctdata (readoctdata.cpp with the mex stub in mexstub/),
+ * so load(file) gives the same struct as readoctdata(filename, options). Several files are converted in parallel,
+ * the mex stub is thread safe, the HDF5 calls are serialized in Mat73::writeFile. The conversion does not use the
+ * module state of readoctdata (cache, prefetches, trace session), the options which need it are rejected.
+ */
+
+#include "mat73_writer.h"
+
+#include "../helper/thread_pool.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <mex.h>
+
+
+// readoctdata.cpp
+mxArray* convertOctFile(const mxArray* mxOptions, const std::string& filename);
+
+namespace
+{
+	struct Arguments
+	{
+		std::vector<std::string> files;
+		std::string              outputDir;      // empty -> next to the input file
+		std::string              variable    = "data";
+		int                      threads     = 0;
+		int                      compression = 3;
+		mxArray*                 options     = nullptr;
+	};
+
+	void printUsage()
+	{
+		std::fprintf(stderr,
+			"usage: octdata2mat [options] files...\n"
+			"  --output=DIR          directory of the .mat files (default: next to the input file)\n"
+			"  --variable=NAME       variable name in the .mat files (default: data)\n"
+			"  --threads=N           files converted in parallel, 0 uses all cores (default: 0)\n"
+			"  --compression=N       deflate level 0 (none) .. 9 (default: 3)\n"
+			"  --option=NAME=VALUE   readoctdata option, numbers (also comma separated lists) or text,\n"
+			"                        e.g. --option=bscanVolume=1 --option=bscanRange=1,10 --option=segmentationType=int16\n"
+			"                        (not supported: cache, traceFile, rawCache)\n");
+	}
+
+	// readoctdata options which use the module state of readoctdata, not synchronized between the conversion threads
+	bool isUnsupportedOption(const std::string& name)
+	{
+		return name == "cache"
+		    || name == "traceFile"
+		    || name == "rawCache";
+	}
+
+	bool parseArgument(const char* arg, const char* name, std::string& value)
+	{
+		const std::size_t length = std::strlen(name);
+		if(std::strncmp(arg, name, length) != 0 || arg[length] != '=')
+			return false;
+		value = arg + length + 1;
+		return true;
+	}
+
+	// "1,10" -> [1 10], other values as string
+	mxArray* createOptionValue(const std::string& value)
+	{
+		std::vector<double> numbers;
+		const char* pos = value.c_str();
+		while(*pos)
+		{
+			char* end = nullptr;
+			numbers.push_back(std::strtod(pos, &end));
+			if(end == pos || (*end != ',' && *end != '\0'))
+				return mxCreateString(value.c_str());
+			pos = *end == ',' ? end + 1 : end;
+		}
+		if(numbers.empty())
+			return mxCreateString(value.c_str());
+
+		mxArray* array = mxCreateNumericMatrix(1, static_cast<mwSize>(numbers.size()), mxDOUBLE_CLASS, mxREAL);
+		std::memcpy(mxGetData(array), numbers.data(), numbers.size()*sizeof(double));
+		return array;
+	}
+
+	bool parseArguments(int argc, char* argv[], Arguments& args)
+	{
+		args.options = mxCreateStructMatrix(1, 1, 0, nullptr);
+		for(int i = 1; i < argc; ++i)
+		{
+			const char* arg = argv[i];
+			std::string value;
+			if(std::strncmp(arg, "--", 2) != 0)
+				args.files.push_back(arg);
+			else if(parseArgument(arg, "--output", value))
+				args.outputDir = value;
+			else if(parseArgument(arg, "--variable", value))
+				args.variable = value;
+			else if(parseArgument(arg, "--threads", value))
+				args.threads = std::atoi(value.c_str());
+			else if(parseArgument(arg, "--compression", value))
+				args.compression = std::atoi(value.c_str());
+			else if(parseArgument(arg, "--option", value) && value.find('=') != std::string::npos && value.find('=') > 0)
+			{
+				const std::size_t sep  = value.find('=');
+				const std::string name = value.substr(0, sep);
+				if(isUnsupportedOption(name))
+				{
+					std::fprintf(stderr, "option %s is not supported by octdata2mat\n", name.c_str());
+					return false;
+				}
+				mxSetField(args.options, 0, name.c_str(), createOptionValue(value.substr(sep + 1)));
+			}
+			else
+			{
+				std::fprintf(stderr, "unknown argument %s\n", arg);
+				return false;
+			}
+		}
+		return !args.files.empty();
+	}
+
+	// readoctdata returns an empty structure for files it can not read
+	bool hasPatient(const mxArray* data)
+	{
+		const int numFields = mxGetNumberOfFields(data);
+		for(int field = 0; field < numFields; ++field)
+			if(std::strncmp(mxGetFieldNameByNumber(data, field), "Patient_", 8) == 0)
+				return true;
+		return false;
+	}
+
+	std::string getOutputFilename(const std::string& input, const std::string& outputDir)
+	{
+		std::filesystem::path path(input);
+		path.replace_extension(".mat");
+		if(!outputDir.empty())
+			path = std::filesystem::path(outputDir)/path.filename();
+		return path.string();
+	}
+}
+
+
+int main(int argc, char* argv[])
+{
+	Arguments args;
+	if(!parseArguments(argc, argv, args))
+	{
+		printUsage();
+		return EXIT_FAILURE;
+	}
+
+	std::mutex       printMutex;
+	std::atomic<int> numFailed(0);
+
+	// one file per job: decode and convert (convertOctFile), compress and write (Mat73::writeFile)
+	parallelFor(args.files.size(), getNumThreads(args.threads), [&](std::size_t i)
+		{
+			const std::string& input  = args.files[i];
+			const std::string  output = getOutputFilename(input, args.outputDir);
+
+			std::string error;
+			try
+			{
+				mxArray* data = convertOctFile(args.options, input);
+				if(!hasPatient(data))
+					error = "no data loaded";
+				else
+					Mat73::writeFile(output, args.variable, data, args.compression, error);
+				mxDestroyArray(data);
+			}
+			catch(const std::exception& e)
+			{
+				error = e.what();
+			}
+
+			std::lock_guard<std::mutex> lock(printMutex);
+			if(error.empty())
+				std::printf("%s -> %s\n", input.c_str(), output.c_str());
+			else
+			{
+				std::fprintf(stderr, "%s: %s\n", input.c_str(), error.c_str());
+				++numFailed;
+			}
+		});
+
+	mxDestroyArray(args.options);
+	MexStub::unloadModule();
+	return numFailed > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
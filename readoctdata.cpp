@@ -17,8 +17,13 @@
 
 #include "mex.h"
 
+#include <algorithm>
+#include <chrono>
 #include <cmath>
 #include <limits>
+#include <future>
+#include <map>
+#include <type_traits>
 #include <boost/type_index.hpp>
 #include<boost/lexical_cast.hpp>
 #include<string>
@@ -36,10 +41,82 @@
 #include "helper/matlab_helper.h"
 #include "helper/matlab_types.h"
 #include "helper/opencv_helper.h"
+#include "helper/thread_pool.h"
+#include "helper/octdata_cache.h"
+#include "helper/parameter_table.h"
+#include "helper/convert_kernels.h"
+#include "helper/call_statistics.h"
+#include "helper/trace.h"
+#include "helper/raw_cache.h"
 
 
 namespace
 {
+	struct SeriesBScans;
+
+	// options for the conversion to the matlab structure, read from the same options struct as OctData::FileReadOptions
+	struct ConvertOptions
+	{
+		bool bscanVolume = false; // all B-scans of a series in one rows x cols x N array (series fields volume and volumeAngio)
+		int  numThreads  = 1;     // threads for the pixel and segmentation copies, 0 -> number of cores
+		bool metadataOnly = false; // no images, only data nodes and segmentation
+		bool cache        = false; // keep the decoded file in the module cache (readoctdata('cache', ...))
+		bool bscanTable   = false; // the data of all B-scans as one column per parameter (series field bscanData) instead of a struct per B-scan
+		bool segmentationArray = false;    // all segmentation lines of a series in one layers x A-scans x B-scans array (series fields segmentation and segmentationLayers)
+		std::string segmentationType = "double"; // matlab class of the segmentation lines: double, single or int16
+		double      segmentationScale = ConvertKernel::int16DefaultScale; // int16: stored value = depth*segmentationScale, -32768 for missing values
+
+		// subset of the B-scans and their images, ranges are [first last] (1 based), empty -> all
+		std::vector<int> bscanRange;
+		int              bscanStride = 1;
+		std::vector<int> cropRows;
+		std::vector<int> cropCols;
+		int              decimation  = 1; // only every n-th row and column of the B-scan images
+
+		// only convert the matching subtree, e.g. "Patient_3/Study_1/Series_7" or "Patient_*/Study_1" (* and ? as wildcards)
+		std::string      select;
+
+		// readoctdata('batch', ...): decoding threads (0 -> number of cores) and memory limit for the decoded, not yet converted files
+		int              batchThreads = 0;
+		std::uint64_t    batchMemory  = std::uint64_t(4) << 30;
+
+		// chrome trace json of the call (file decode, B-scan conversion, image copies), empty -> no tracing
+		std::string      traceFile;
+
+		// drop every decoded B-scan as soon as it is converted (lower peak memory), only if the file is not held by the cache
+		bool             releaseDecoded = false;
+
+		// readoctdata(filename, options): store the converted structure in filename.octraw and read it from there, "copy" or "map" (memmapfile descriptions for the large arrays), empty -> off
+		std::string      rawCache;
+
+		CallStatistics*  statistics = nullptr; // not an option: phase timers of [data, statistics] = readoctdata(filename, options)
+		std::vector<SeriesBScans>* pendingBScans = nullptr; // not an option: B-scans are converted by convertReleaseBScans()
+
+		template<typename T>
+		void getSetParameter(T& getSet)
+		{
+			getSet("bscanVolume" , bscanVolume );
+			getSet("numThreads"  , numThreads  );
+			getSet("metadataOnly", metadataOnly);
+			getSet("cache"       , cache       );
+			getSet("bscanTable"  , bscanTable  );
+			getSet("segmentationArray", segmentationArray);
+			getSet("segmentationType" , segmentationType );
+			getSet("segmentationScale", segmentationScale);
+			getSet("bscanRange"  , bscanRange  );
+			getSet("bscanStride" , bscanStride );
+			getSet("cropRows"    , cropRows    );
+			getSet("cropCols"    , cropCols    );
+			getSet("decimation"  , decimation  );
+			getSet("select"      , select      );
+			getSet("batchThreads", batchThreads);
+			getSet("batchMemory" , batchMemory );
+			getSet("traceFile"   , traceFile   );
+			getSet("releaseDecoded", releaseDecoded);
+			getSet("rawCache"    , rawCache    );
+		}
+	};
+
 	template<typename S>
 	std::string getSubStructureName()
 	{
@@ -59,49 +136,521 @@ namespace
 	}
 
 	// general export methods
-	mxArray* convertSlo(const OctData::SloImage& slo)
+	mxArray* convertSlo(const OctData::SloImage& slo, const ConvertOptions& opt)
 	{
+		CallStatistics::Timer timer(opt.statistics, "convertSlo");
+		Trace::Scope          scope("convertSlo");
+
 		ParameterToOptions pto;
 		pto.addMxArray("data", writeParameter(slo));
-		pto.addMxArray("image", convertMatrix<uint8_t>(slo.getImage()));
+		if(!opt.metadataOnly)
+			pto.addMxArray("image", convertMatrix(slo.getImage()));
 
 		return pto.getMxOptions();
 	}
 
-	mxArray* convertSegmentation(const OctData::Segmentationlines& seglines)
+	// [first last] (1 based, inclusive) -> [first, end) limited to size, empty -> all
+	std::pair<std::size_t, std::size_t> getRange(const std::vector<int>& range, std::size_t size)
+	{
+		if(range.size() < 2)
+			return std::make_pair(std::size_t(0), size);
+
+		const std::size_t first = range[0] > 1 ? std::min(static_cast<std::size_t>(range[0] - 1), size) : 0;
+		const std::size_t end   = range[1] > 0 ? std::min(static_cast<std::size_t>(range[1]    ), size) : 0;
+		return std::make_pair(first, std::max(first, end));
+	}
+
+	std::size_t getDecimation(const ConvertOptions& opt)
+	{
+		return opt.decimation > 1 ? static_cast<std::size_t>(opt.decimation) : 1;
+	}
+
+	// only a header on the crop window, no copy
+	cv::Mat cropImage(const cv::Mat& image, const ConvertOptions& opt)
+	{
+		if(image.empty() || (opt.cropRows.empty() && opt.cropCols.empty()))
+			return image;
+
+		const std::pair<std::size_t, std::size_t> rows = getRange(opt.cropRows, static_cast<std::size_t>(image.rows));
+		const std::pair<std::size_t, std::size_t> cols = getRange(opt.cropCols, static_cast<std::size_t>(image.cols));
+		return image(cv::Range(static_cast<int>(rows.first), static_cast<int>(rows.second))
+		           , cv::Range(static_cast<int>(cols.first), static_cast<int>(cols.second)));
+	}
+
+	OctData::Series::BScanList selectBScans(const OctData::Series::BScanList& bscans, const ConvertOptions& opt)
+	{
+		if(opt.bscanRange.empty() && opt.bscanStride <= 1)
+			return bscans;
+
+		const std::pair<std::size_t, std::size_t> range = getRange(opt.bscanRange, bscans.size());
+		const std::size_t stride = opt.bscanStride > 1 ? static_cast<std::size_t>(opt.bscanStride) : 1;
+
+		OctData::Series::BScanList selected;
+		for(std::size_t i = range.first; i < range.second; i += stride)
+			selected.push_back(bscans[i]);
+		return selected;
+	}
+
+
+	typedef OctData::Segmentationlines::Segmentline::value_type SegmentlineValueType;
+	static_assert(std::is_same<SegmentlineValueType, double>::value, "ConvertKernel expects double segmentation lines");
+
+	enum class SegmentationType { Double, Single, Int16 };
+
+	bool parseSegmentationType(const std::string& name, SegmentationType& type)
+	{
+		if(name == "double")
+			type = SegmentationType::Double;
+		else if(name == "single")
+			type = SegmentationType::Single;
+		else if(name == "int16")
+			type = SegmentationType::Int16;
+		else
+			return false;
+		return true;
+	}
+
+	// segmentationType is checked by loadOptions(), the conversion itself raises no error (readoctdata('batch', ...) converts while decoding threads run)
+	SegmentationType getSegmentationType(const ConvertOptions& opt)
+	{
+		SegmentationType type = SegmentationType::Double;
+		parseSegmentationType(opt.segmentationType, type);
+		return type;
+	}
+
+	mxClassID getClassID(SegmentationType type)
+	{
+		switch(type)
+		{
+			case SegmentationType::Single: return MatlabType<float       >::classID;
+			case SegmentationType::Int16 : return MatlabType<std::int16_t>::classID;
+			case SegmentationType::Double: break;
+		}
+		return MatlabType<double>::classID;
+	}
+
+	template<typename T>
+	T getMissingValue()
+	{
+		return std::numeric_limits<T>::quiet_NaN();
+	}
+
+	template<>
+	std::int16_t getMissingValue<std::int16_t>()
+	{
+		return ConvertKernel::int16Missing;
+	}
+
+	struct ImageCopy
+	{
+		cv::Mat     image;
+		void*       matlabPtr;
+		std::size_t decimation;
+	};
+
+	// depth values are shifted and scaled to the crop window and decimation of the image (and segmentationScale for int16),
+	// the destination is padded with missing values (NaN, int16: -32768) up to dstSize (no line -> only missing values)
+	struct SegmentlineCopy
+	{
+		const OctData::Segmentationlines::Segmentline* line;
+		void*            matlabPtr;
+		SegmentationType type;
+		std::size_t      first;
+		std::size_t      step;
+		std::size_t      size;
+		std::size_t      dstStride; // 1 for a vector, number of layers for the segmentation array
+		std::size_t      dstSize;
+		double           offset;
+		double           scale;     // out = (in - offset)*scale
+
+		template<typename T>
+		void copyTo(T* out) const
+		{
+			const std::size_t numValues = line ? size : 0;
+			if(line)
+				ConvertKernel::convertStrided(line->data() + first, step, out, dstStride, numValues, offset, scale);
+
+			for(std::size_t i = numValues; i < dstSize; ++i)
+				out[i*dstStride] = getMissingValue<T>();
+		}
+
+		void run() const
+		{
+			switch(type)
+			{
+				case SegmentationType::Double: copyTo(static_cast<double      *>(matlabPtr)); break;
+				case SegmentationType::Single: copyTo(static_cast<float       *>(matlabPtr)); break;
+				case SegmentationType::Int16 : copyTo(static_cast<std::int16_t*>(matlabPtr)); break;
+			}
+		}
+	};
+
+	// A-scans of the segmentation line after crop and decimation
+	std::pair<std::size_t, std::size_t> getSegmentlineCols(const OctData::Segmentationlines::Segmentline& seg, const ConvertOptions& opt, std::size_t& size)
+	{
+		const std::pair<std::size_t, std::size_t> cols = getRange(opt.cropCols, seg.size());
+		size = decimatedSize(cols.second - cols.first, getDecimation(opt));
+		return cols;
+	}
+
+	SegmentlineCopy makeSegmentlineCopy(const OctData::Segmentationlines::Segmentline* seg, void* matlabPtr, const ConvertOptions& opt, std::size_t dstStride = 1, std::size_t dstSize = 0)
 	{
+		const std::size_t decimation = getDecimation(opt);
+		const double      offset     = opt.cropRows.size() >= 2 && opt.cropRows[0] > 1 ? opt.cropRows[0] - 1 : 0;
+
+		std::size_t size  = 0;
+		std::size_t first = 0;
+		if(seg)
+			first = getSegmentlineCols(*seg, opt, size).first;
+
+		const SegmentationType type  = getSegmentationType(opt);
+		const double           scale = (type == SegmentationType::Int16 ? opt.segmentationScale : 1.)/static_cast<double>(decimation);
+		return SegmentlineCopy{seg, matlabPtr, type, first, decimation, size, dstStride, std::max(size, dstSize), offset, scale};
+	}
+
+	// pixel and segmentation copies of one B-scan, the destination arrays are created before on the matlab thread
+	struct BScanCopyJobs
+	{
+		std::vector<ImageCopy>       images;
+		std::vector<SegmentlineCopy> segmentlines;
+
+		void run() const
+		{
+			for(const ImageCopy& image : images)
+			{
+				Trace::Scope scope("copyImage");
+				copyMatrix(image.image, image.matlabPtr, image.decimation);
+			}
+			for(const SegmentlineCopy& seg : segmentlines)
+				seg.run();
+		}
+	};
+
+	mxArray* createImage(const cv::Mat& image, const ConvertOptions& opt, BScanCopyJobs& jobs)
+	{
+		const cv::Mat     window     = cropImage(image, opt);
+		const std::size_t decimation = getDecimation(opt);
+
+		mxArray* matlabMat = createMatrix(window, decimation);
+		if(matlabMat)
+			jobs.images.push_back(ImageCopy{window, mxGetData(matlabMat), decimation});
+		return matlabMat;
+	}
+
+	mxArray* convertSegmentation(const OctData::Segmentationlines& seglines, const ConvertOptions& opt, BScanCopyJobs& jobs)
+	{
+		const mxClassID classID = getClassID(getSegmentationType(opt));
+
 		ParameterToOptions pto;
 		for(OctData::Segmentationlines::SegmentlineType type : OctData::Segmentationlines::getSegmentlineTypes())
 		{
 			const OctData::Segmentationlines::Segmentline& seg = seglines.getSegmentLine(type);
 			if(!seg.empty())
-				pto(OctData::Segmentationlines::getSegmentlineName(type), seg);
+			{
+				std::size_t size;
+				getSegmentlineCols(seg, opt, size);
+
+				mxArray* matlabSeg = mxCreateNumericMatrix(static_cast<mwSize>(size), 1, classID, mxREAL);
+				if(matlabSeg)
+					jobs.segmentlines.push_back(makeSegmentlineCopy(&seg, mxGetData(matlabSeg), opt));
+				pto.addMxArray(OctData::Segmentationlines::getSegmentlineName(type), matlabSeg);
+			}
 		}
 
 		return pto.getMxOptions();
 	}
 
-	mxArray* convertBScan(const std::shared_ptr<const OctData::BScan>& bscan)
+	bool hasImageGrid(const ConvertOptions& opt)
+	{
+		return opt.cropRows.size() >= 2 || opt.cropCols.size() >= 2 || getDecimation(opt) > 1;
+	}
+
+	// pixel grid of the returned images and segmentation in the full B-scan (data keeps the geometry of the full B-scan):
+	// row r and column c (1 based) are row firstRow + (r-1)*decimation and A-scan firstCol + (c-1)*decimation
+	mxArray* createImageGrid(const ConvertOptions& opt)
+	{
+		double firstRow   = opt.cropRows.size() >= 2 && opt.cropRows[0] > 1 ? opt.cropRows[0] : 1;
+		double firstCol   = opt.cropCols.size() >= 2 && opt.cropCols[0] > 1 ? opt.cropCols[0] : 1;
+		double decimation = static_cast<double>(getDecimation(opt));
+
+		ParameterToOptions pto;
+		pto("firstRow"  , firstRow  );
+		pto("firstCol"  , firstCol  );
+		pto("decimation", decimation);
+		return pto.getMxOptions();
+	}
+
+	mxArray* convertBScan(const std::shared_ptr<const OctData::BScan>& bscan, const ConvertOptions& opt, bool withImage, bool withAngioImage, BScanCopyJobs& jobs)
 	{
 		if(!bscan)
 			return nullptr;
 
+		CallStatistics::Timer timer(opt.statistics, "convertBScan");
+
 		ParameterToOptions pto;
 
-		pto.addMxArray("data", writeParameter(*bscan));
+		if(!opt.bscanTable)
+			pto.addMxArray("data", writeParameter(*bscan));
+		if(hasImageGrid(opt))
+			pto.addMxArray("imageGrid", createImageGrid(opt));
 
-		if(!bscan->getImage().empty())
-			pto.addMxArray("image", convertMatrix<uint8_t>(bscan->getImage()));
-		if(!bscan->getAngioImage().empty())
-			pto.addMxArray("imageAngio", convertMatrix<uint8_t>(bscan->getAngioImage()));
+		if(withImage && !bscan->getImage().empty())
+			pto.addMxArray("image", createImage(bscan->getImage(), opt, jobs));
+		if(withAngioImage && !bscan->getAngioImage().empty())
+			pto.addMxArray("imageAngio", createImage(bscan->getAngioImage(), opt, jobs));
 
-		pto.addMxArray("segmentation", convertSegmentation(bscan->getSegmentLines()));
+		if(!opt.segmentationArray)
+			pto.addMxArray("segmentation", convertSegmentation(bscan->getSegmentLines(), opt, jobs));
 
 		return pto.getMxOptions();
 	}
 
+	const cv::Mat& getBScanImage(const OctData::BScan& bscan, bool angio)
+	{
+		return angio ? bscan.getAngioImage() : bscan.getImage();
+	}
+
+	// all images need the same size and type, otherwise no volume is created
+	bool isVolumeConvertible(const OctData::Series::BScanList& bscans, bool angio)
+	{
+		if(bscans.empty() || !bscans[0])
+			return false;
+
+		const cv::Mat& first = getBScanImage(*bscans[0], angio);
+		if(first.empty() || first.channels() != 1)
+			return false;
+
+		for(const std::shared_ptr<const OctData::BScan>& bscan : bscans)
+		{
+			if(!bscan)
+				return false;
+
+			const cv::Mat& image = getBScanImage(*bscan, angio);
+			if(image.rows != first.rows || image.cols != first.cols || image.type() != first.type())
+				return false;
+		}
+		return true;
+	}
+
+	mxArray* createBScanVolume(const OctData::Series::BScanList& bscans, bool angio, const ConvertOptions& opt)
+	{
+		const cv::Mat first = cropImage(getBScanImage(*bscans[0], angio), opt);
+		return createVolume(first, static_cast<mwSize>(bscans.size()), getDecimation(opt));
+	}
+
+	// copy of the image of B-scan index into slice index of a volume from createBScanVolume()
+	void addVolumeSliceCopy(mxArray* volume, const OctData::BScan& bscan, bool angio, std::size_t index, std::size_t numSlices, const ConvertOptions& opt, BScanCopyJobs& jobs)
+	{
+		if(!volume)
+			return;
+
+		const std::size_t sliceBytes = mxGetNumberOfElements(volume)*mxGetElementSize(volume)/numSlices;
+		char* slicePtr = reinterpret_cast<char*>(mxGetData(volume)) + index*sliceBytes;
+		jobs.images.push_back(ImageCopy{cropImage(getBScanImage(bscan, angio), opt), slicePtr, getDecimation(opt)});
+	}
+
+	// layers x A-scans x B-scans, only the layers used by any B-scan, NaN for missing and shorter lines
+	mxArray* createSegmentationArray(const OctData::Series::BScanList& bscans, const ConvertOptions& opt, std::vector<OctData::Segmentationlines::SegmentlineType>& layers, std::size_t& numAScans, mxArray*& layerNames)
+	{
+		for(OctData::Segmentationlines::SegmentlineType type : OctData::Segmentationlines::getSegmentlineTypes())
+		{
+			bool used = false;
+			for(const std::shared_ptr<const OctData::BScan>& bscan : bscans)
+			{
+				if(!bscan || bscan->getSegmentLines().getSegmentLine(type).empty())
+					continue;
+
+				const OctData::Segmentationlines::Segmentline& seg = bscan->getSegmentLines().getSegmentLine(type);
+
+				std::size_t size;
+				getSegmentlineCols(seg, opt, size);
+				numAScans = std::max(numAScans, size);
+				used = true;
+			}
+			if(used)
+				layers.push_back(type);
+		}
+
+		if(layers.empty())
+			return nullptr;
+
+		const std::size_t numLayers = layers.size();
+		mwSize dimsArray[] = { static_cast<mwSize>(numLayers), static_cast<mwSize>(numAScans), static_cast<mwSize>(bscans.size()) };
+		mxArray* segmentation = mxCreateNumericArray(3, dimsArray, getClassID(getSegmentationType(opt)), mxREAL);
+		if(!segmentation)
+			return nullptr;
+
+		layerNames = mxCreateCellMatrix(static_cast<mwSize>(numLayers), 1);
+		for(std::size_t l = 0; l < numLayers; ++l)
+			mxSetCell(layerNames, static_cast<mwIndex>(l), mxCreateString(OctData::Segmentationlines::getSegmentlineName(layers[l])));
+
+		return segmentation;
+	}
+
+	// copies of the lines of B-scan index (nullptr -> missing values) into a segmentation array from createSegmentationArray()
+	void addSegmentationCopies(mxArray* segmentation, const OctData::BScan* bscan, std::size_t index, const std::vector<OctData::Segmentationlines::SegmentlineType>& layers, std::size_t numAScans, const ConvertOptions& opt, BScanCopyJobs& jobs)
+	{
+		if(!segmentation)
+			return;
+
+		const std::size_t numLayers = layers.size();
+		const std::size_t elemSize  = mxGetElementSize(segmentation);
+		char* segPtr = reinterpret_cast<char*>(mxGetData(segmentation)) + numLayers*numAScans*index*elemSize;
+		for(std::size_t l = 0; l < numLayers; ++l)
+		{
+			const OctData::Segmentationlines::Segmentline* seg = bscan ? &bscan->getSegmentLines().getSegmentLine(layers[l]) : nullptr;
+			if(seg && seg->empty())
+				seg = nullptr;
+
+			jobs.segmentlines.push_back(makeSegmentlineCopy(seg, segPtr + l*elemSize, opt, numLayers, numAScans));
+		}
+	}
+
+	// B-scans of a series and their matlab destinations, created by convertStructure<OctData::Series>() and filled by convertBScans()
+	struct SeriesBScans
+	{
+		OctData::Series::BScanList bscans;
+		mxArray*    cell             = nullptr; // 1 x number of B-scans, B-scan structs
+		bool        imageVolume      = false;
+		bool        imageAngioVolume = false;
+		mxArray*    volume           = nullptr;
+		mxArray*    volumeAngio      = nullptr;
+		mxArray*    segmentation     = nullptr;
+		std::vector<OctData::Segmentationlines::SegmentlineType> layers;
+		std::size_t numAScans        = 0;
+	};
+
+	// B-scans [begin, end): first create the matlab arrays (mex API is not thread safe), then copy the pixel and segmentation data in parallel
+	void convertBScans(SeriesBScans& series, std::size_t begin, std::size_t end, const ConvertOptions& opt)
+	{
+		std::vector<BScanCopyJobs> jobs(end - begin);
+
+		const bool withImage      = !series.imageVolume      && !opt.metadataOnly;
+		const bool withAngioImage = !series.imageAngioVolume && !opt.metadataOnly;
+		const std::size_t numBScans = series.bscans.size();
+		for(std::size_t i = begin; i < end; ++i)
+		{
+			const std::shared_ptr<const OctData::BScan>& bscan = series.bscans[i];
+			BScanCopyJobs& bscanJobs = jobs[i - begin];
+			if(bscan)
+			{
+				addVolumeSliceCopy(series.volume     , *bscan, false, i, numBScans, opt, bscanJobs);
+				addVolumeSliceCopy(series.volumeAngio, *bscan, true , i, numBScans, opt, bscanJobs);
+			}
+			addSegmentationCopies(series.segmentation, bscan.get(), i, series.layers, series.numAScans, opt, bscanJobs);
+
+			Trace::Scope scope("convertBScan", static_cast<std::int64_t>(i));
+			mxSetCell(series.cell, static_cast<mwIndex>(i), convertBScan(bscan, opt, withImage, withAngioImage, bscanJobs));
+		}
+
+		CallStatistics::Timer timer(opt.statistics, "copyData");
+		parallelFor(jobs.size(), getNumThreads(opt.numThreads), [&jobs, begin](std::size_t i)
+			{
+				Trace::Scope scope("copyBScan", static_cast<std::int64_t>(begin + i));
+				jobs[i].run();
+			});
+	}
+
+	// releaseDecoded: converts the B-scans in chunks and drops every B-scan (and with it its images) after its chunk is copied
+	void convertReleaseBScans(SeriesBScans& series, const ConvertOptions& opt)
+	{
+		const std::size_t chunkSize = std::max(std::size_t(16), 4*getNumThreads(opt.numThreads));
+		for(std::size_t begin = 0; begin < series.bscans.size(); begin += chunkSize)
+		{
+			const std::size_t end = std::min(begin + chunkSize, series.bscans.size());
+			convertBScans(series, begin, end, opt);
+			for(std::size_t i = begin; i < end; ++i)
+				series.bscans[i].reset();
+		}
+	}
+
+	// row i: data of B-scan i, rows of missing B-scans are 0
+	mxArray* createBScanTable(const OctData::Series::BScanList& bscans)
+	{
+		ParameterTable table(bscans.size());
+		ParameterToTable toTable(table);
+		for(std::size_t i = 0; i < bscans.size(); ++i)
+		{
+			if(!bscans[i])
+				continue;
+			table.setRow(i);
+			bscans[i]->getSetParameter(toTable);
+		}
+		return table.getMxArray();
+	}
+
+	// wildcards * and ?
+	bool matchesGlob(const char* pattern, const char* text)
+	{
+		const char* starPattern = nullptr;
+		const char* starText    = nullptr;
+		while(*text)
+		{
+			if(*pattern == '*')
+			{
+				starPattern = ++pattern;
+				starText    = text;
+			}
+			else if(*pattern == '?' || *pattern == *text)
+			{
+				++pattern;
+				++text;
+			}
+			else if(starPattern)
+			{
+				pattern = starPattern;
+				text    = ++starText;
+			}
+			else
+				return false;
+		}
+		while(*pattern == '*')
+			++pattern;
+		return *pattern == '\0';
+	}
+
+	std::vector<std::string> splitPath(const std::string& path)
+	{
+		std::vector<std::string> parts;
+		std::size_t start = 0;
+		while(start <= path.size())
+		{
+			std::size_t end = path.find('/', start);
+			if(end == std::string::npos)
+				end = path.size();
+			if(end > start)
+				parts.push_back(path.substr(start, end - start));
+			start = end + 1;
+		}
+		return parts;
+	}
+
+	// path like "Patient_3/Study_1", a selection with fewer levels matches the whole subtree
+	bool isSelected(const std::string& select, const std::string& path)
+	{
+		if(select.empty())
+			return true;
+
+		const std::vector<std::string> selectParts = splitPath(select);
+		const std::vector<std::string> pathParts   = splitPath(path);
+		const std::size_t levels = std::min(selectParts.size(), pathParts.size());
+		for(std::size_t i = 0; i < levels; ++i)
+			if(!matchesGlob(selectParts[i].c_str(), pathParts[i].c_str()))
+				return false;
+		return true;
+	}
+
+	template<typename S>
+	std::string getSubStructurePath(const std::string& path, int id)
+	{
+		static const std::string structureName = getSubStructureName<S>();
+
+		std::string subStructName = structureName + '_' + boost::lexical_cast<std::string>(id);
+		return path.empty() ? subStructName : path + '/' + subStructName;
+	}
+
 	template<typename S>
-	mxArray* convertStructure(const S& structure)
+	mxArray* convertStructure(const S& structure, const ConvertOptions& opt, const std::string& path = std::string())
 	{
 		static const std::string structureName = getSubStructureName<S>();
 
@@ -110,7 +659,11 @@ namespace
 
 		for(typename S::SubstructurePair const& subStructPair : structure)
 		{
-			mxArray* subStruct = convertStructure(*subStructPair.second);
+			const std::string subStructPath = getSubStructurePath<S>(path, subStructPair.first);
+			if(!isSelected(opt.select, subStructPath))
+				continue;
+
+			mxArray* subStruct = convertStructure(*subStructPair.second, opt, subStructPath);
 			std::string subStructName = structureName + '_' + boost::lexical_cast<std::string>(subStructPair.first);
 			pto.addMxArray(subStructName, subStruct);
 		}
@@ -119,50 +672,821 @@ namespace
 
 
 	template<>
-	mxArray* convertStructure<OctData::Series>(const OctData::Series& series)
+	mxArray* convertStructure<OctData::Series>(const OctData::Series& series, const ConvertOptions& opt, const std::string& /*path*/)
 	{
 		ParameterToOptions pto;
 		pto.addMxArray("data", writeParameter(series));
 
-		pto.addMxArray("slo", convertSlo(series.getSloImage()));
+		pto.addMxArray("slo", convertSlo(series.getSloImage(), opt));
 
-		const OctData::Series::BScanList& bscans = series.getBScans();
+		SeriesBScans seriesBScans;
+		seriesBScans.bscans = selectBScans(series.getBScans(), opt);
+		const OctData::Series::BScanList& bscans = seriesBScans.bscans;
+
+		if(opt.bscanVolume && !opt.metadataOnly)
+		{
+			seriesBScans.imageVolume      = isVolumeConvertible(bscans, false);
+			seriesBScans.imageAngioVolume = isVolumeConvertible(bscans, true );
+
+			if(!seriesBScans.imageVolume && !bscans.empty())
+				mexPrintf("bscanVolume: B-scans differ in size or type, images are stored per B-scan\n");
+
+			if(seriesBScans.imageVolume)
+			{
+				seriesBScans.volume = createBScanVolume(bscans, false, opt);
+				pto.addMxArray("volume", seriesBScans.volume);
+			}
+			if(seriesBScans.imageAngioVolume)
+			{
+				seriesBScans.volumeAngio = createBScanVolume(bscans, true, opt);
+				pto.addMxArray("volumeAngio", seriesBScans.volumeAngio);
+			}
+		}
+
+		if(opt.bscanTable)
+			pto.addMxArray("bscanData", createBScanTable(bscans));
+
+		if(opt.segmentationArray)
+		{
+			mxArray* layerNames = nullptr;
+			seriesBScans.segmentation = createSegmentationArray(bscans, opt, seriesBScans.layers, seriesBScans.numAScans, layerNames);
+			pto.addMxArray("segmentation"      , seriesBScans.segmentation);
+			pto.addMxArray("segmentationLayers", layerNames);
+		}
+
+		if(getSegmentationType(opt) == SegmentationType::Int16)
+			pto.addMxArray("segmentationScale", mxCreateDoubleScalar(opt.segmentationScale));
+
+		seriesBScans.cell = mxCreateCellMatrix(1, static_cast<mwSize>(bscans.size()));
+		pto.addMxArray("bscans", seriesBScans.cell);
+
+		if(opt.pendingBScans)
+			opt.pendingBScans->push_back(std::move(seriesBScans));
+		else
+			convertBScans(seriesBScans, 0, seriesBScans.bscans.size(), opt);
+
+		return pto.getMxOptions();
+	}
+
+
+	// with releaseDecoded and oct as only reference to the data, the B-scans are converted after the remaining structure
+	// and oct is released before, so the decoded data shrinks while the matlab arrays are filled
+	mxArray* convertOct(std::shared_ptr<const OctData::OCT> oct, const ConvertOptions& opt)
+	{
+		if(!opt.releaseDecoded || oct.use_count() != 1)
+			return convertStructure(*oct, opt);
+
+		std::vector<SeriesBScans> pendingBScans;
+		ConvertOptions releaseOptions = opt;
+		releaseOptions.pendingBScans = &pendingBScans;
+
+		mxArray* matlabOut = convertStructure(*oct, releaseOptions);
+		oct.reset(); // the B-scans are only held by pendingBScans
+
+		for(SeriesBScans& series : pendingBScans)
+			convertReleaseBScans(series, opt);
+		return matlabOut;
+	}
+
+
+	// all option values are checked here, on the matlab thread before any worker thread is started
+	void loadOptions(const mxArray* mxOptions, OctData::FileReadOptions& options, ConvertOptions& convertOptions)
+	{
+		if(mxOptions && mxIsStruct(mxOptions))
+		{
+			ParameterFromOptions paraFromOptions(mxOptions);
+			options.getSetParameter(paraFromOptions);
+			convertOptions.getSetParameter(paraFromOptions);
+		}
+
+		SegmentationType segmentationType;
+		if(!parseSegmentationType(convertOptions.segmentationType, segmentationType))
+			mexErrMsgIdAndTxt("MATLAB:mexcpp:options", "segmentationType: unknown type %s (double, single, int16)", convertOptions.segmentationType.c_str());
+
+		if(!convertOptions.rawCache.empty() && convertOptions.rawCache != "copy" && convertOptions.rawCache != "map")
+			mexErrMsgIdAndTxt("MATLAB:mexcpp:options", "rawCache: unknown mode %s (copy, map)", convertOptions.rawCache.c_str());
+
+		if(!(convertOptions.segmentationScale > 0) || !std::isfinite(convertOptions.segmentationScale))
+			mexErrMsgIdAndTxt("MATLAB:mexcpp:options", "segmentationScale: %g is not a positive number", convertOptions.segmentationScale);
+	}
+
+	template<typename S>
+	void collectSeries(const S& structure, const std::string& select, std::vector<const OctData::Series*>& seriesList, const std::string& path = std::string())
+	{
+		for(typename S::SubstructurePair const& subStructPair : structure)
+		{
+			const std::string subStructPath = getSubStructurePath<S>(path, subStructPair.first);
+			if(isSelected(select, subStructPath))
+				collectSeries(*subStructPair.second, select, seriesList, subStructPath);
+		}
+	}
+
+	template<>
+	void collectSeries<OctData::Series>(const OctData::Series& series, const std::string& /*select*/, std::vector<const OctData::Series*>& seriesList, const std::string& /*path*/)
+	{
+		seriesList.push_back(&series);
+	}
+
+	// file opened with readoctdata('open', filename), the series are numbered in the order of the matlab structure
+	struct OpenFile
+	{
+		std::shared_ptr<const OctData::OCT> oct;
+		std::vector<const OctData::Series*> series;
+		ConvertOptions                      options;
+	};
+
+
+	// file decoded in the background by readoctdata('prefetch', filename, [options])
+	struct Prefetch
+	{
+		OctDataCache::FileState                                 state;
+		std::shared_future<std::shared_ptr<const OctData::OCT>> oct;
+		std::uint64_t                                           sequence = 0; // order of the prefetch commands, the oldest is dropped first
+	};
+
+	constexpr std::size_t maxPrefetches = 4; // unused prefetched files, a grader stepping through scans only needs the next ones
+
+
+	// state of the mex module, kept between the calls
+	OctDataCache                           octCache;
+	std::map<std::uint64_t, OpenFile>      openFiles;
+	std::map<std::string, Prefetch>        prefetches; // key: filename and read options
+	std::vector<std::shared_future<std::shared_ptr<const OctData::OCT>>> discardedPrefetches; // dropped while running, kept until the decode has finished
+	std::uint64_t                          nextPrefetch = 0;
+	std::uint64_t                          nextHandle = 1;
+	bool                                   mexLocked  = false;
+
+	bool isReady(const std::shared_future<std::shared_ptr<const OctData::OCT>>& oct)
+	{
+		return oct.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+	}
+
+	// the last reference of a running std::async future waits for the decode in its destructor,
+	// so a dropped prefetch that still runs is moved to discardedPrefetches instead of blocking the matlab thread
+	void discardPrefetch(Prefetch& prefetch)
+	{
+		if(!isReady(prefetch.oct))
+			discardedPrefetches.push_back(std::move(prefetch.oct));
+	}
+
+	// releases the discarded prefetches which have finished, without waiting for the others
+	void reapPrefetches()
+	{
+		discardedPrefetches.erase(std::remove_if(discardedPrefetches.begin(), discardedPrefetches.end()
+			, [](const std::shared_future<std::shared_ptr<const OctData::OCT>>& oct) { return isReady(oct); })
+			, discardedPrefetches.end());
+	}
+
+	void updateMexLock()
+	{
+		reapPrefetches();
+		const bool needLock = !octCache.empty() || !openFiles.empty() || !prefetches.empty() || !discardedPrefetches.empty();
+		if(needLock && !mexLocked)
+			mexLock();
+		else if(!needLock && mexLocked)
+			mexUnlock();
+		mexLocked = needLock;
+	}
+
+	void cleanupModule()
+	{
+		prefetches.clear(); // waits for the running decodes
+		discardedPrefetches.clear();
+		openFiles.clear();
+		octCache.clear();
+	}
+
+	void registerCleanup()
+	{
+		static bool registered = false;
+		if(!registered)
+			mexAtExit(&cleanupModule);
+		registered = true;
+	}
+
+	// LibOctData decode, thread safe (prefetch and batch threads)
+	std::shared_ptr<const OctData::OCT> decodeFile(const std::string& filename, const OctData::FileReadOptions& options)
+	{
+		Trace::Scope scope("decodeFile");
+		return std::make_shared<const OctData::OCT>(OctData::OctFileRead::openFile(filename, options));
+	}
+
+	void finishTrace(Trace::Session& trace, const ConvertOptions& opt)
+	{
+		if(!trace.finish())
+			mexPrintf("traceFile: can not write %s\n", opt.traceFile.c_str());
+	}
+
+	// string representation of a struct with scalar and string fields, used to compare read options
+	std::string toKeyString(const mxArray* matlabMat)
+	{
+		if(!matlabMat)
+			return std::string();
+
+		if(mxIsChar(matlabMat))
+			return '"' + getScalarConvert<std::string>(matlabMat) + '"';
+
+		if(mxIsStruct(matlabMat))
+		{
+			std::string key = "{";
+			const int numFields = mxGetNumberOfFields(matlabMat);
+			for(int i = 0; i < numFields; ++i)
+				key += std::string(mxGetFieldNameByNumber(matlabMat, i)) + '=' + toKeyString(mxGetFieldByNumber(matlabMat, 0, i)) + ';';
+			return key + '}';
+		}
+
+		std::string key = "[";
+		const std::size_t numElements = mxGetNumberOfElements(matlabMat);
+		for(std::size_t i = 0; i < numElements; ++i)
+			key += boost::lexical_cast<std::string>(getValueConvert<double>(matlabMat, i)) + ',';
+		return key + ']';
+	}
+
+	std::string optionsKey(OctData::FileReadOptions options)
+	{
+		ParameterToOptions paraToOptions;
+		options.getSetParameter(paraToOptions);
+		mxArray* mxOptions = paraToOptions.getMxOptions();
+		std::string key = toKeyString(mxOptions);
+		if(mxOptions)
+			mxDestroyArray(mxOptions);
+		return key;
+	}
+
+	// key of a raw cache file: all options which change the converted structure
+	std::string rawCacheKey(const OctData::FileReadOptions& options, const ConvertOptions& opt)
+	{
+		const ConvertOptions defaults;
+		ConvertOptions keyOptions = opt;
+		keyOptions.numThreads     = defaults.numThreads;
+		keyOptions.cache          = defaults.cache;
+		keyOptions.batchThreads   = defaults.batchThreads;
+		keyOptions.batchMemory    = defaults.batchMemory;
+		keyOptions.traceFile      = defaults.traceFile;
+		keyOptions.releaseDecoded = defaults.releaseDecoded;
+		keyOptions.rawCache       = defaults.rawCache; // copy and map use the same file
+
+		ParameterToOptions paraToOptions;
+		keyOptions.getSetParameter(paraToOptions);
+		mxArray* mxOptions = paraToOptions.getMxOptions();
+		std::string key = optionsKey(options) + '\n' + toKeyString(mxOptions);
+		if(mxOptions)
+			mxDestroyArray(mxOptions);
+		return key;
+	}
+
+	// rawCache is checked by loadOptions()
+	RawCache::Mode getRawCacheMode(const ConvertOptions& opt)
+	{
+		return opt.rawCache == "map" ? RawCache::Mode::Map : RawCache::Mode::Copy;
+	}
+
+	std::string getRawCacheFilename(const std::string& filename)
+	{
+		return filename + ".octraw";
+	}
+
+	// in map mode the written file is read again, so the first call returns the same form as the later ones
+	mxArray* writeRawCache(const std::string& filename, mxArray* matlabOut, const OctDataCache::FileState& state, const std::string& key, RawCache::Mode mode)
+	{
+		const std::string rawFilename = getRawCacheFilename(filename);
+		if(!RawCache::Writer().write(rawFilename, matlabOut, state.mtime, state.size, key))
+		{
+			mexPrintf("rawCache: can not write %s\n", rawFilename.c_str());
+			return matlabOut;
+		}
+
+		if(mode == RawCache::Mode::Map)
+		{
+			if(mxArray* mapped = RawCache::Reader().read(rawFilename, state.mtime, state.size, key, mode))
+			{
+				mxDestroyArray(matlabOut);
+				return mapped;
+			}
+		}
+		return matlabOut;
+	}
+
+	std::string prefetchKey(const std::string& filename, const std::string& optionsKey)
+	{
+		return filename + '\n' + optionsKey;
+	}
+
+	bool isReady(const Prefetch& prefetch)
+	{
+		return isReady(prefetch.oct);
+	}
+
+	// memory of a finished prefetch, 0 while it runs or if the read failed
+	std::size_t getPrefetchBytes(const Prefetch& prefetch)
+	{
+		if(!isReady(prefetch))
+			return 0;
+		try
+		{
+			const std::shared_ptr<const OctData::OCT>& oct = prefetch.oct.get();
+			return oct ? estimateMemory(*oct) : 0;
+		}
+		catch(const std::exception&)
+		{
+			return 0;
+		}
+	}
+
+	std::size_t getPrefetchBytes()
+	{
+		std::size_t bytes = 0;
+		for(const std::pair<const std::string, Prefetch>& prefetch : prefetches)
+			bytes += getPrefetchBytes(prefetch.second);
+		return bytes;
+	}
 
-		const uint32_t dirLength = static_cast<uint32_t>(bscans.size());
-		mxArray* mxarr = mxCreateCellMatrix(1, dirLength);
-		for(uint32_t i = 0; i < dirLength; ++i)
-			mxSetCell(mxarr, i, convertBScan(bscans[i]));
+	// unused prefetches are limited to maxPrefetches files and, once decoded, count against the cache budget;
+	// the oldest are dropped first, a running one without waiting for its decode (discardPrefetch)
+	void limitPrefetches()
+	{
+		std::size_t bytes = getPrefetchBytes();
+		for(;;)
+		{
+			const bool overCount  = prefetches.size() > maxPrefetches;
+			const bool overBudget = bytes > 0 && bytes + octCache.getUsedBytes() > octCache.getBudget();
+			if(!overCount && !overBudget)
+				break;
 
-		pto.addMxArray("bscans", mxarr);
+			// over the count the oldest prefetch, over the budget the oldest decoded one
+			std::map<std::string, Prefetch>::iterator oldest = prefetches.end();
+			for(std::map<std::string, Prefetch>::iterator it = prefetches.begin(); it != prefetches.end(); ++it)
+				if((overCount || isReady(it->second)) && (oldest == prefetches.end() || it->second.sequence < oldest->second.sequence))
+					oldest = it;
+			if(oldest == prefetches.end())
+				break;
 
+			bytes -= getPrefetchBytes(oldest->second);
+			discardPrefetch(oldest->second);
+			prefetches.erase(oldest);
+		}
+		updateMexLock();
+	}
+
+	// waits for a prefetch of the file, nullptr if there is none or the file was changed after it was started
+	std::shared_ptr<const OctData::OCT> takePrefetch(const std::string& key, const OctDataCache::FileState& state)
+	{
+		std::map<std::string, Prefetch>::iterator it = prefetches.find(key);
+		if(it == prefetches.end())
+			return nullptr;
+
+		Prefetch prefetch = std::move(it->second);
+		prefetches.erase(it);
+
+		if(prefetch.state != state)
+		{
+			discardPrefetch(prefetch);
+			updateMexLock();
+			return nullptr;
+		}
+		updateMexLock();
+
+		return prefetch.oct.get(); // rethrows the read error
+	}
+
+	std::shared_ptr<const OctData::OCT> openFile(const std::string& filename, const OctData::FileReadOptions& options, const ConvertOptions& opt)
+	{
+		if(!opt.cache && prefetches.empty())
+			return decodeFile(filename, options);
+
+		const std::string             key   = optionsKey(options);
+		const OctDataCache::FileState state = OctDataCache::FileState::fromFile(filename);
+
+		std::shared_ptr<const OctData::OCT> oct;
+		if(opt.cache)
+			oct = octCache.get(filename, key, state);
+
+		if(!oct)
+		{
+			oct = takePrefetch(prefetchKey(filename, key), state);
+			if(!oct)
+				oct = decodeFile(filename, options);
+			if(opt.cache && oct->begin() != oct->end())
+				octCache.insert(filename, key, state, oct);
+			limitPrefetches();
+		}
+		return oct;
+	}
+
+
+	// command interface: readoctdata(command, arguments...)
+	mxArray* getCacheStatistics()
+	{
+		ParameterToOptions pto;
+		octCache.getStatistics(pto);
+		std::uint64_t numPrefetches = prefetches.size();
+		std::uint64_t prefetchBytes = getPrefetchBytes();
+		std::uint64_t numDiscarded  = discardedPrefetches.size();
+		pto("prefetches"   , numPrefetches);
+		pto("prefetchBytes", prefetchBytes);
+		pto("discardedPrefetches", numDiscarded);
 		return pto.getMxOptions();
 	}
+
+	void cacheCommand(int /*nlhs*/, mxArray* plhs[], int nrhs, const mxArray* prhs[])
+	{
+		if(nrhs < 1 || !mxIsChar(prhs[0]))
+		{
+			mexErrMsgIdAndTxt("MATLAB:mexcpp:nargin", "usage: readoctdata('cache', 'stats' | 'clear' | 'budget', [bytes])");
+			return;
+		}
+
+		const std::string subCommand = getScalarConvert<std::string>(prhs[0]);
+		if(subCommand == "clear")
+		{
+			for(std::pair<const std::string, Prefetch>& prefetch : prefetches)
+				discardPrefetch(prefetch.second);
+			prefetches.clear();
+			octCache.clear();
+		}
+		else if(subCommand == "budget")
+		{
+			if(nrhs < 2 || !mxIsNumeric(prhs[1]))
+			{
+				mexErrMsgIdAndTxt("MATLAB:mexcpp:nargin", "usage: readoctdata('cache', 'budget', bytes)");
+				return;
+			}
+			octCache.setBudget(static_cast<std::size_t>(getScalarConvert<double>(prhs[1])));
+			limitPrefetches();
+		}
+		else if(subCommand != "stats")
+		{
+			mexErrMsgIdAndTxt("MATLAB:mexcpp:nargin", "unknown cache command: %s", subCommand.c_str());
+			return;
+		}
+
+		updateMexLock();
+		plhs[0] = getCacheStatistics();
+	}
+
+	// readoctdata('prefetch', filename, [options]): decodes the file in a background thread and returns immediately,
+	// the next read of the file with the same LibOctData options takes the result
+	void prefetchCommand(int /*nlhs*/, mxArray* /*plhs*/[], int nrhs, const mxArray* prhs[])
+	{
+		if(nrhs < 1 || nrhs > 2 || !mxIsChar(prhs[0]))
+		{
+			mexErrMsgIdAndTxt("MATLAB:mexcpp:nargin", "usage: readoctdata('prefetch', filename, [options])");
+			return;
+		}
+
+		OctData::FileReadOptions options;
+		ConvertOptions convertOptions;
+		loadOptions(nrhs == 2 ? prhs[1] : nullptr, options, convertOptions);
+
+		const std::string filename = getScalarConvert<std::string>(prhs[0]);
+		const std::string key      = prefetchKey(filename, optionsKey(options));
+		if(prefetches.count(key) > 0)
+			return;
+
+		Prefetch prefetch;
+		prefetch.state    = OctDataCache::FileState::fromFile(filename);
+		prefetch.sequence = nextPrefetch++;
+		prefetch.oct      = std::async(std::launch::async, [filename, options]()
+			{
+				return decodeFile(filename, options);
+			}).share();
+
+		prefetches.emplace(key, std::move(prefetch));
+		limitPrefetches();
+	}
+
+	void openCommand(int /*nlhs*/, mxArray* plhs[], int nrhs, const mxArray* prhs[])
+	{
+		if(nrhs < 1 || nrhs > 2 || !mxIsChar(prhs[0]))
+		{
+			mexErrMsgIdAndTxt("MATLAB:mexcpp:nargin", "usage: handle = readoctdata('open', filename, [options])");
+			return;
+		}
+
+		OpenFile file;
+		OctData::FileReadOptions options;
+		loadOptions(nrhs == 2 ? prhs[1] : nullptr, options, file.options);
+
+		file.oct = openFile(getScalarConvert<std::string>(prhs[0]), options, file.options);
+		collectSeries(*file.oct, file.options.select, file.series);
+
+		const std::uint64_t handle = nextHandle++;
+		openFiles.emplace(handle, std::move(file));
+		updateMexLock();
+
+		plhs[0] = mxCreateDoubleScalar(static_cast<double>(handle));
+	}
+
+	std::map<std::uint64_t, OpenFile>::iterator findOpenFile(const mxArray* mxHandle)
+	{
+		std::uint64_t handle = 0;
+		if(!getHandle(mxHandle, handle))
+			mexErrMsgIdAndTxt("MATLAB:mexcpp:handle", "readoctdata handle has to be a positive integer");
+
+		std::map<std::uint64_t, OpenFile>::iterator it = openFiles.find(handle);
+		if(it == openFiles.end())
+			mexErrMsgIdAndTxt("MATLAB:mexcpp:handle", "invalid readoctdata handle");
+
+		return it;
+	}
+
+	const OpenFile& getOpenFile(const mxArray* mxHandle)
+	{
+		return findOpenFile(mxHandle)->second;
+	}
+
+	// 1 based index as in matlab
+	std::size_t getIndex(const mxArray* mxIndex, std::size_t size, const char* name)
+	{
+		const double index = mxIndex ? getScalarConvert<double>(mxIndex) : 1.;
+		if(index < 1 || index > static_cast<double>(size))
+			mexErrMsgIdAndTxt("MATLAB:mexcpp:index", "%s index out of range (1 ... %u)", name, static_cast<unsigned int>(size));
+		return static_cast<std::size_t>(index) - 1;
+	}
+
+	// readoctdata('bscan', handle, index, [series]), readoctdata('slo', handle, [series]), readoctdata('info', handle)
+	void bscanCommand(int /*nlhs*/, mxArray* plhs[], int nrhs, const mxArray* prhs[])
+	{
+		if(nrhs < 2 || nrhs > 3)
+		{
+			mexErrMsgIdAndTxt("MATLAB:mexcpp:nargin", "usage: bscan = readoctdata('bscan', handle, index, [series])");
+			return;
+		}
+
+		const OpenFile& openFile = getOpenFile(prhs[0]);
+		const OctData::Series& series = *openFile.series[getIndex(nrhs == 3 ? prhs[2] : nullptr, openFile.series.size(), "series")];
+		const OctData::Series::BScanList& bscans = series.getBScans();
+
+		ConvertOptions options = openFile.options;
+		options.bscanTable        = false;
+		options.segmentationArray = false;
+
+		const std::size_t index = getIndex(prhs[1], bscans.size(), "B-scan");
+		if(!bscans[index])
+		{
+			mexErrMsgIdAndTxt("MATLAB:mexcpp:bscan", "B-scan %u is not loaded", static_cast<unsigned int>(index + 1));
+			return;
+		}
+
+		BScanCopyJobs jobs;
+		const bool withImages = !options.metadataOnly;
+		plhs[0] = convertBScan(bscans[index], options, withImages, withImages, jobs);
+		jobs.run();
+	}
+
+	void sloCommand(int /*nlhs*/, mxArray* plhs[], int nrhs, const mxArray* prhs[])
+	{
+		if(nrhs < 1 || nrhs > 2)
+		{
+			mexErrMsgIdAndTxt("MATLAB:mexcpp:nargin", "usage: slo = readoctdata('slo', handle, [series])");
+			return;
+		}
+
+		const OpenFile& openFile = getOpenFile(prhs[0]);
+		const OctData::Series& series = *openFile.series[getIndex(nrhs == 2 ? prhs[1] : nullptr, openFile.series.size(), "series")];
+		plhs[0] = convertSlo(series.getSloImage(), openFile.options);
+	}
+
+	void infoCommand(int /*nlhs*/, mxArray* plhs[], int nrhs, const mxArray* prhs[])
+	{
+		if(nrhs != 1)
+		{
+			mexErrMsgIdAndTxt("MATLAB:mexcpp:nargin", "usage: info = readoctdata('info', handle)");
+			return;
+		}
+
+		const OpenFile& openFile = getOpenFile(prhs[0]);
+		ConvertOptions options = openFile.options;
+		options.metadataOnly = true;
+		plhs[0] = convertStructure(*openFile.oct, options);
+	}
+
+	void closeCommand(int /*nlhs*/, mxArray* /*plhs*/[], int nrhs, const mxArray* prhs[])
+	{
+		if(nrhs != 1)
+		{
+			mexErrMsgIdAndTxt("MATLAB:mexcpp:nargin", "usage: readoctdata('close', handle | 'all')");
+			return;
+		}
+
+		if(mxIsChar(prhs[0]) && getScalarConvert<std::string>(prhs[0]) == "all")
+			openFiles.clear();
+		else
+			openFiles.erase(findOpenFile(prhs[0]));
+		updateMexLock();
+	}
+
+	constexpr std::size_t batchDecodeFactor = 4; // estimated decoded size / file size, before a batch file is decoded
+
+	// result of a decoding thread of readoctdata('batch', ...)
+	struct BatchResult
+	{
+		std::shared_ptr<const OctData::OCT> oct;
+		std::string                         error;
+	};
+
+	void batchCommand(int nlhs, mxArray* plhs[], int nrhs, const mxArray* prhs[])
+	{
+		if(nrhs < 1 || nrhs > 2 || !mxIsCell(prhs[0]))
+		{
+			mexErrMsgIdAndTxt("MATLAB:mexcpp:nargin", "usage: [data, errors] = readoctdata('batch', filenames[cell], [options])");
+			return;
+		}
+
+		OctData::FileReadOptions options;
+		ConvertOptions convertOptions;
+		loadOptions(nrhs == 2 ? prhs[1] : nullptr, options, convertOptions);
+
+		const std::size_t numFiles = mxGetNumberOfElements(prhs[0]);
+		std::vector<std::string> filenames(numFiles);
+		for(std::size_t i = 0; i < numFiles; ++i)
+		{
+			const mxArray* mxFilename = mxGetCell(prhs[0], i);
+			if(!mxFilename || !mxIsChar(mxFilename))
+			{
+				mexErrMsgIdAndTxt("MATLAB:mexcpp:nargin", "batch: filenames{%u} is not a string", static_cast<unsigned int>(i + 1));
+				return;
+			}
+			filenames[i] = getScalarConvert<std::string>(mxFilename);
+		}
+
+		// reserved against batchMemory while a file is decoded, afterwards its decoded size counts
+		std::vector<std::size_t> estimates(numFiles);
+		for(std::size_t i = 0; i < numFiles; ++i)
+			estimates[i] = static_cast<std::size_t>(OctDataCache::FileState::fromFile(filenames[i]).size)*batchDecodeFactor;
+
+		mxArray* data   = mxCreateCellMatrix(1, static_cast<mwSize>(numFiles));
+		mxArray* errors = mxCreateCellMatrix(1, static_cast<mwSize>(numFiles));
+
+		Trace::Session trace(convertOptions.traceFile);
+
+		// the decoding threads must not use the mex api, the conversion to matlab runs in this thread
+		const std::size_t numThreads = getNumThreads(convertOptions.batchThreads);
+		produceConsume<BatchResult>(numFiles, numThreads, 2*numThreads, static_cast<std::size_t>(convertOptions.batchMemory)
+			, [&](std::size_t i)
+			{
+				BatchResult result;
+				try
+				{
+					result.oct = decodeFile(filenames[i], options);
+					if(result.oct->begin() == result.oct->end())
+						result.error = "no data loaded";
+				}
+				catch(const std::exception& e)
+				{
+					result.error = e.what();
+				}
+				return result;
+			}
+			, [&](std::size_t i) { return estimates[i]; }
+			, [](const BatchResult& result) { return result.oct ? estimateMemory(*result.oct) : std::size_t(0); }
+			, [&](std::size_t i, BatchResult& result)
+			{
+				if(result.error.empty())
+				{
+					try
+					{
+						Trace::Scope scope("convertFile", static_cast<std::int64_t>(i));
+						mxSetCell(data, static_cast<mwIndex>(i), convertOct(std::move(result.oct), convertOptions));
+					}
+					catch(const std::exception& e)
+					{
+						result.error = e.what();
+					}
+				}
+				mxSetCell(errors, static_cast<mwIndex>(i), mxCreateString(result.error.c_str()));
+			});
+
+		finishTrace(trace, convertOptions);
+
+		plhs[0] = data;
+		if(nlhs > 1)
+			plhs[1] = errors;
+		else
+			mxDestroyArray(errors);
+	}
+
+	bool isCommand(const std::string& name)
+	{
+		return name == "cache"
+		    || name == "batch"
+		    || name == "prefetch"
+		    || name == "open"
+		    || name == "bscan"
+		    || name == "slo"
+		    || name == "info"
+		    || name == "close";
+	}
+
+	void runCommand(const std::string& command, int nlhs, mxArray* plhs[], int nrhs, const mxArray* prhs[])
+	{
+		if(command == "cache")
+			cacheCommand(nlhs, plhs, nrhs, prhs);
+		else if(command == "batch")
+			batchCommand(nlhs, plhs, nrhs, prhs);
+		else if(command == "prefetch")
+			prefetchCommand(nlhs, plhs, nrhs, prhs);
+		else if(command == "open")
+			openCommand(nlhs, plhs, nrhs, prhs);
+		else if(command == "bscan")
+			bscanCommand(nlhs, plhs, nrhs, prhs);
+		else if(command == "slo")
+			sloCommand(nlhs, plhs, nrhs, prhs);
+		else if(command == "info")
+			infoCommand(nlhs, plhs, nrhs, prhs);
+		else if(command == "close")
+			closeCommand(nlhs, plhs, nrhs, prhs);
+	}
 }
 
 
-mxArray* readOctData(const mxArray* mxOptions, const std::string& filename)
+// conversion of an OCT which is not read from a file (benchmark), mxOptions as for readoctdata(filename, options)
+mxArray* convertOctData(std::shared_ptr<const OctData::OCT> oct, const mxArray* mxOptions)
 {
-	// Load Options
 	OctData::FileReadOptions options;
+	ConvertOptions convertOptions;
+	loadOptions(mxOptions, options, convertOptions);
+
+	return convertOct(std::move(oct), convertOptions);
+}
 
-	if(mxOptions && mxIsStruct(mxOptions))
-	{
-		ParameterFromOptions paraFromOptions(mxOptions);
-		options.getSetParameter(paraFromOptions);
-	}
+
+// decode and convert a file without the module state (cache, prefetches, trace session, raw cache),
+// so it can run in several threads at once (octdata2mat), mxOptions as for readoctdata(filename, options)
+mxArray* convertOctFile(const mxArray* mxOptions, const std::string& filename)
+{
+	OctData::FileReadOptions options;
+	ConvertOptions convertOptions;
+	loadOptions(mxOptions, options, convertOptions);
+
+	return convertOct(decodeFile(filename, options), convertOptions);
+}
+
+
+mxArray* readOctData(const mxArray* mxOptions, const std::string& filename, CallStatistics* statistics = nullptr)
+{
+	CallStatistics::Timer timer(statistics, "readOctData");
+
+	// Load Options
+	OctData::FileReadOptions options;
+	ConvertOptions convertOptions;
+	loadOptions(mxOptions, options, convertOptions);
+	convertOptions.statistics = statistics;
 
 	if(filename.empty())
 	{
 		ParameterToOptions paraToOptions;
 		options.getSetParameter(paraToOptions);
+		convertOptions.getSetParameter(paraToOptions);
 		return paraToOptions.getMxOptions();
 	}
 
-	OctData::OCT oct = OctData::OctFileRead::openFile(filename, options);
+	Trace::Session trace(convertOptions.traceFile);
+
+	OctDataCache::FileState rawCacheState;
+	std::string             rawKey;
+	if(!convertOptions.rawCache.empty())
+	{
+		const RawCache::Mode mode = getRawCacheMode(convertOptions);
+		rawCacheState = OctDataCache::FileState::fromFile(filename);
+		rawKey        = rawCacheKey(options, convertOptions);
+
+		mxArray* cached = nullptr;
+		{
+			CallStatistics::Timer rawTimer(statistics, "readRawCache");
+			Trace::Scope          rawScope("readRawCache");
+			cached = RawCache::Reader().read(getRawCacheFilename(filename), rawCacheState.mtime, rawCacheState.size, rawKey, mode);
+		}
+		// after the scope, its event is recorded while the session still traces
+		if(cached)
+		{
+			finishTrace(trace, convertOptions);
+			return cached;
+		}
+	}
+
+	std::shared_ptr<const OctData::OCT> oct;
+	{
+		CallStatistics::Timer openTimer(statistics, "openFile");
+		Trace::Scope          openScope("openFile");
+		oct = openFile(filename, options, convertOptions);
+	}
 
-	mxArray* matlabOut = convertStructure(oct);
+	mxArray* matlabOut;
+	{
+		CallStatistics::Timer convertTimer(statistics, "convertStructure");
+		Trace::Scope          convertScope("convertStructure");
+		matlabOut = convertOct(std::move(oct), convertOptions);
+	}
 
+	if(!convertOptions.rawCache.empty())
+	{
+		CallStatistics::Timer rawTimer(statistics, "writeRawCache");
+		Trace::Scope          rawScope("writeRawCache");
+		matlabOut = writeRawCache(filename, matlabOut, rawCacheState, rawKey, getRawCacheMode(convertOptions));
+	}
 
+	finishTrace(trace, convertOptions);
 	return matlabOut;
 }
 
@@ -173,22 +1497,32 @@ void mexFunction(int            nlhs
                , int            nrhs
                , const mxArray* prhs[])
 {
-	/* Check for proper number of arguments */
-	if(nrhs > 2 || nrhs < 1)
+	registerCleanup();
+
+	if(nrhs >= 1 && !mxIsChar(prhs[0]))
 	{
-		mexErrMsgIdAndTxt("MATLAB:mexcpp:nargin", "MEXCPP requires 1 or 2 input arguments (filename, options[struct])");
+		mexErrMsgIdAndTxt("MATLAB:mexcpp:nargin", "requires filename");
 		return;
 	}
-	else if(nlhs > 1)
+
+	std::string filename = nrhs >= 1 ? getScalarConvert<std::string>(prhs[0]) : std::string();
+
+	// options are always a struct, so readoctdata(command, arguments...) does not collide with readoctdata(filename, options)
+	if(nrhs >= 2 && !mxIsStruct(prhs[1]) && isCommand(filename))
 	{
-		mexErrMsgIdAndTxt("MATLAB:mexcpp:nargout", "MEXCPP requires only one output argument.");
+		runCommand(filename, nlhs, plhs, nrhs - 1, prhs + 1);
 		return;
 	}
 
-
-	if(!mxIsChar(prhs[0]))
+	/* Check for proper number of arguments */
+	if(nrhs > 2 || nrhs < 1)
 	{
-		mexErrMsgIdAndTxt("MATLAB:mexcpp:nargin", "requires filename");
+		mexErrMsgIdAndTxt("MATLAB:mexcpp:nargin", "MEXCPP requires 1 or 2 input arguments (filename, options[struct])");
+		return;
+	}
+	else if(nlhs > 2)
+	{
+		mexErrMsgIdAndTxt("MATLAB:mexcpp:nargout", "MEXCPP requires one or two output arguments (data, statistics).");
 		return;
 	}
 
@@ -198,8 +1532,14 @@ void mexFunction(int            nlhs
 		mxOptions = prhs[1];
 
 
-	std::string filename = getScalarConvert<std::string>(prhs[0]);
-	plhs[0] = readOctData(mxOptions, filename);
+	if(nlhs > 1 && !filename.empty())
+	{
+		CallStatistics statistics;
+		plhs[0] = readOctData(mxOptions, filename, &statistics);
+		plhs[1] = statistics.getMxArray(plhs[0]);
+	}
+	else
+		plhs[0] = readOctData(mxOptions, filename);
 
 	return;
 }
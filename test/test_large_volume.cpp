@@ -0,0 +1,180 @@
+/*
+ * Copyright (c) 2018 Kay Gawlik <kaydev@amarunet.de> <kay.gawlik@beuth-hochschule.de> <kay.gawlik@charite.de>
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/*
+ * 64 bit sizes of the conversion helpers (helper/opencv_helper.h, helper/matlab_helper.h) on arrays of more than 2^31 elements.
+ * The mex stub allocates with calloc, only the touched pages of the large arrays become resident.
+ */
+
+#include "../helper/opencv_helper.h"
+#include "../helper/matlab_helper.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+
+
+namespace
+{
+	typedef std::unique_ptr<mxArray, decltype(&mxDestroyArray)> MxArrayPtr;
+
+	constexpr std::size_t limit31 = std::size_t(1) << 31;
+
+	int numFailed = 0;
+
+	void check(bool condition, const char* name)
+	{
+		std::printf("%-64s %s\n", name, condition ? "ok" : "FAILED");
+		if(!condition)
+			++numFailed;
+	}
+
+	cv::Mat createImage(int rows, int cols, int channels)
+	{
+		cv::Mat image(rows, cols, CV_MAKETYPE(CV_8U, channels));
+		for(int row = 0; row < rows; ++row)
+		{
+			std::uint8_t* ptr = image.ptr<std::uint8_t>(row);
+			for(int col = 0; col < cols*channels; ++col)
+				ptr[col] = static_cast<std::uint8_t>(row*7 + col*13);
+		}
+		return image;
+	}
+
+	// channel of a (rows x cols x channels) with the single channel b, transposed: a(row, col) == b(col, row)
+	bool equalChannel(const cv::Mat& a, int channel, const cv::Mat& b, bool transposed)
+	{
+		if(a.rows != (transposed ? b.cols : b.rows) || a.cols != (transposed ? b.rows : b.cols))
+			return false;
+		for(int row = 0; row < a.rows; ++row)
+			for(int col = 0; col < a.cols; ++col)
+				if(a.ptr<std::uint8_t>(row)[col*a.channels() + channel] != (transposed ? b.ptr<std::uint8_t>(col)[row*b.channels()] : b.ptr<std::uint8_t>(row)[col*b.channels()]))
+					return false;
+		return true;
+	}
+
+	// rows x cols plane of a matlab array (col based) equals a channel of the opencv image
+	bool equalPlane(const std::uint8_t* plane, const cv::Mat& image, int channel)
+	{
+		const std::size_t rows = static_cast<std::size_t>(image.rows);
+		for(int row = 0; row < image.rows; ++row)
+			for(int col = 0; col < image.cols; ++col)
+				if(plane[static_cast<std::size_t>(col)*rows + static_cast<std::size_t>(row)] != image.ptr<std::uint8_t>(row)[col*image.channels() + channel])
+					return false;
+		return true;
+	}
+
+	// B-scans in and out of the last slice of a rows x cols x N volume with more than 2^31 elements
+	void testVolume()
+	{
+		const cv::Mat image = createImage(496, 512, 1);
+		const std::size_t sliceSize = static_cast<std::size_t>(image.rows)*static_cast<std::size_t>(image.cols);
+		const mwSize numSlices = static_cast<mwSize>(limit31/sliceSize + 2);
+
+		MxArrayPtr volume(createVolume(image, numSlices), &mxDestroyArray);
+		check(volume && mxGetNumberOfElements(volume.get()) > limit31, "createVolume: more than 2^31 elements");
+		if(!volume)
+			return;
+
+		std::uint8_t* lastSlice = static_cast<std::uint8_t*>(mxGetData(volume.get())) + (numSlices - 1)*sliceSize;
+		copyMatrix(image, lastSlice);
+		check(equalPlane(lastSlice, image, 0), "copyMatrix: last slice");
+
+		check(equalChannel(image, 0, convertVolumeSlice(volume.get(), numSlices - 1), false), "convertVolumeSlice: last slice");
+		check(equalChannel(image, 0, wrapTransposedVolumeSlice(volume.get(), numSlices - 1), true), "wrapTransposedVolumeSlice: last slice");
+
+		// one channel of a colour image into the last slice and back
+		const cv::Mat colour = createImage(496, 512, 3);
+		copyMatrixTranspose(colour, lastSlice, 1);
+		check(equalPlane(lastSlice, colour, 1), "copyMatrixTranspose (opencv -> matlab): last slice");
+
+		cv::Mat back(496, 512, CV_8UC3);
+		copyMatrixTranspose(lastSlice, back, 2);
+		check(equalChannel(back, 2, convertVolumeSlice(volume.get(), numSlices - 1), false), "copyMatrixTranspose (matlab -> opencv): last slice");
+	}
+
+	// sizes beyond the opencv and size_t limits give empty results, no truncated matrices and no mex errors
+	void testLimits()
+	{
+		const mwSize columnDims[] = { limit31, 1 };
+		MxArrayPtr column(mxCreateNumericArray(2, columnDims, mxUINT8_CLASS, mxREAL), &mxDestroyArray);
+		check(convertMatrix(column.get()).empty(), "convertMatrix: 2^31 rows -> empty");
+		check(convertVolumeSlice(column.get(), 0).empty(), "convertVolumeSlice: 2^31 rows -> empty");
+
+		const mwSize rowDims[] = { 1, limit31 };
+		MxArrayPtr row(mxCreateNumericArray(2, rowDims, mxUINT8_CLASS, mxREAL), &mxDestroyArray);
+		check(wrapTransposedVolumeSlice(row.get(), 0).empty(), "wrapTransposedVolumeSlice: 2^31 rows -> empty");
+
+		const mwSize channelDims[] = { 2, 2, CV_CN_MAX + 1 };
+		MxArrayPtr channels(mxCreateNumericArray(3, channelDims, mxUINT8_CLASS, mxREAL), &mxDestroyArray);
+		check(convertMatrix(channels.get()).empty(), "convertMatrix: CV_CN_MAX + 1 channels -> empty");
+
+		check(createVolume(createImage(496, 512, 1), mwSize(1) << 62) == nullptr, "createVolume: size overflow -> nullptr");
+
+		bool stubError = false;
+		const mwSize overflowDims[] = { mwSize(1) << 40, mwSize(1) << 40 };
+		try
+		{
+			mxDestroyArray(mxCreateNumericArray(2, overflowDims, mxUINT8_CLASS, mxREAL));
+		}
+		catch(const MexStub::Error& e)
+		{
+			stubError = e.id() == "MATLAB:array:SizeLimitExceeded";
+		}
+		check(stubError, "mexstub: element count overflow -> SizeLimitExceeded");
+	}
+
+	void testTransposeMatlabMatrix()
+	{
+		MxArrayPtr matrix(mxCreateNumericMatrix(3, 5, mxDOUBLE_CLASS, mxREAL), &mxDestroyArray);
+		double* data = static_cast<double*>(mxGetData(matrix.get()));
+		for(std::size_t i = 0; i < 15; ++i)
+			data[i] = static_cast<double>(i);
+		transposeMatlabMatrix<double>(matrix.get());
+
+		bool transposed = mxGetM(matrix.get()) == 5 && mxGetN(matrix.get()) == 3;
+		data = static_cast<double*>(mxGetData(matrix.get()));
+		for(std::size_t row = 0; row < 3 && transposed; ++row)
+			for(std::size_t col = 0; col < 5; ++col)
+				transposed = transposed && data[row*5 + col] == static_cast<double>(col*3 + row);
+		check(transposed, "transposeMatlabMatrix: 3 x 5");
+
+		// a vector only swaps its dims, 1 x (2^31 + 3) -> (2^31 + 3) x 1
+		const mwSize length = static_cast<mwSize>(limit31 + 3);
+		MxArrayPtr vector(mxCreateNumericMatrix(1, length, mxUINT8_CLASS, mxREAL), &mxDestroyArray);
+		transposeMatlabMatrix<std::uint8_t>(vector.get());
+		check(mxGetM(vector.get()) == length && mxGetN(vector.get()) == 1, "transposeMatlabMatrix: 1 x (2^31 + 3)");
+	}
+}
+
+
+int main()
+{
+	try
+	{
+		testVolume();
+		testLimits();
+		testTransposeMatlabMatrix();
+	}
+	catch(const MexStub::Error& e)
+	{
+		std::fprintf(stderr, "%s: %s\n", e.id().c_str(), e.what());
+		return EXIT_FAILURE;
+	}
+
+	MexStub::unloadModule();
+	return numFailed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) 2018 Kay Gawlik <kaydev@amarunet.de> <kay.gawlik@beuth-hochschule.de> <kay.gawlik@charite.de>
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/*
+ * Peak memory of readoctdata with releaseDecoded: the decoded volume and the matlab structure must not exist completely
+ * at the same time. The peak resident memory of a process only grows, so every mode runs in its own process (ctest):
+ *   test_release_decoded default          the measurement has to see both copies    (peak >= 1.75 x data)
+ *   test_release_decoded releaseDecoded   the B-scans are dropped while converting  (peak <  1.5  x data)
+ */
+
+#include "../benchmark/benchmark.h"
+
+#include <octdata/datastruct/oct.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+
+#ifdef __GLIBC__
+	#include <malloc.h>
+#endif
+
+
+// readoctdata.cpp
+mxArray* convertOctData(std::shared_ptr<const OctData::OCT> oct, const mxArray* mxOptions);
+
+int main(int argc, char* argv[])
+{
+	const bool releaseDecoded = argc == 2 && std::strcmp(argv[1], "releaseDecoded") == 0;
+	if(argc != 2 || (!releaseDecoded && std::strcmp(argv[1], "default") != 0))
+	{
+		std::fprintf(stderr, "usage: test_release_decoded default | releaseDecoded\n");
+		return EXIT_FAILURE;
+	}
+
+#ifdef __GLIBC__
+	// a fixed threshold: the freed B-scan images are returned to the system instead of raising the dynamic mmap threshold
+	mallopt(M_MMAP_THRESHOLD, 128*1024);
+#endif
+
+	Benchmark::Config config;
+	config.numBScans = 256;
+	const double dataBytes = static_cast<double>(config.getDataBytes());
+
+	const std::uint64_t baseline = Benchmark::getPeakMemory();
+
+	std::unique_ptr<mxArray, decltype(&mxDestroyArray)> options(Benchmark::createOptions({{"releaseDecoded", releaseDecoded ? "1" : "0"}}), &mxDestroyArray);
+	std::unique_ptr<mxArray, decltype(&mxDestroyArray)> data(convertOctData(std::shared_ptr<const OctData::OCT>(Benchmark::createSyntheticOct(config)), options.get()), &mxDestroyArray);
+
+	const double peak  = static_cast<double>(Benchmark::getPeakMemory() - baseline);
+	const double ratio = peak/dataBytes;
+	std::printf("%s: data %.1f MB, peak %.1f MB (%.2f x data)\n", argv[1], dataBytes/1e6, peak/1e6, ratio);
+
+	data.reset();
+	options.reset();
+	MexStub::unloadModule();
+
+	const bool ok = releaseDecoded ? ratio < 1.5 : ratio >= 1.75;
+	if(!ok)
+		std::fprintf(stderr, "%s: peak memory %.2f x data, expected %s\n", argv[1], ratio, releaseDecoded ? "< 1.5" : ">= 1.75");
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -27,9 +27,41 @@
 #include "helper/matlab_helper.h"
 #include "helper/matlab_types.h"
 #include "helper/opencv_helper.h"
+#include "helper/parameter_table.h"
+#include "helper/thread_pool.h"
+#include "helper/convert_kernels.h"
+#include "helper/call_statistics.h"
+#include "helper/trace.h"
+
+#include <climits>
+#include <cmath>
+#include <map>
+#include <memory>
 
 namespace
 {
+	// options for the conversion from the matlab structure, read from the same options struct as OctData::FileWriteOptions
+	struct WriteOptions
+	{
+		// images are width x height (x N) (e.g. permute(volume, [2 1 3])), this is the memory layout of opencv,
+		// so single channel images are passed to LibOctData without copy
+		bool        imagesTransposed = false;
+		int         numThreads       = 1; // threads for the conversion of the B-scan images and segmentation lines, 0 -> number of cores
+		std::string traceFile;            // chrome trace json of the call (B-scan conversion, image copies, file serialization), empty -> no tracing
+
+		bool copyImages = false; // not an option: the images must not refer to matlab memory (streaming writer)
+
+		CallStatistics* statistics = nullptr; // not an option: phase timers of statistics = writeoctdata(filename, data, options)
+
+		template<typename T>
+		void getSetParameter(T& getSet)
+		{
+			getSet("imagesTransposed", imagesTransposed);
+			getSet("numThreads"      , numThreads      );
+			getSet("traceFile"       , traceFile       );
+		}
+	};
+
 	template<typename S>
 	std::string getSubStructureName()
 	{
@@ -51,17 +83,65 @@ namespace
 		}
 	}
 
+	// arrays which can not be converted -> nullptr, invalid dims -> error; checked in the main thread,
+	// so the conversion threads never need mexPrintf or mexErrMsgIdAndTxt
+	// volume: rows x cols x N (one single channel image per slice), otherwise rows x cols (x channels)
+	const mxArray* checkImageNode(const mxArray* imageNode, bool volume)
+	{
+		if(!imageNode || getDepth(mxGetClassID(imageNode)) < 0)
+			return nullptr;
+
+		const mwSize  numDims = mxGetNumberOfDimensions(imageNode);
+		const mwSize* dims    = mxGetDimensions(imageNode);
+		if(numDims > 3)
+		{
+			mexErrMsgIdAndTxt("MATLAB:mexcpp:image", "image: %u dimensions, expected rows x cols%s", static_cast<unsigned int>(numDims), volume ? " x N" : " (x channels)");
+			return nullptr;
+		}
+
+		// opencv matrices have int rows and cols (imagesTransposed: cols and rows)
+		if(dims[0] > static_cast<mwSize>(INT_MAX) || dims[1] > static_cast<mwSize>(INT_MAX))
+		{
+			mexErrMsgIdAndTxt("MATLAB:mexcpp:size", "image: %llu x %llu exceeds the opencv limit of %d rows and cols"
+			                 , static_cast<unsigned long long>(dims[0]), static_cast<unsigned long long>(dims[1]), INT_MAX);
+			return nullptr;
+		}
+
+		if(!volume && numDims == 3 && dims[2] > static_cast<mwSize>(CV_CN_MAX))
+		{
+			mexErrMsgIdAndTxt("MATLAB:mexcpp:size", "image: %llu channels exceed the opencv limit of %d", static_cast<unsigned long long>(dims[2]), CV_CN_MAX);
+			return nullptr;
+		}
+		return imageNode;
+	}
+
 	// general convert methods
-	cv::Mat convertImage(const mxArray* matlabStruct, const char* imageStr)
+	cv::Mat convertImageNode(const mxArray* imageNode, const WriteOptions& opt)
+	{
+		if(opt.imagesTransposed)
+			return opt.copyImages ? wrapTransposedMatrix(imageNode).clone() : wrapTransposedMatrix(imageNode);
+		return convertMatrix(imageNode);
+	}
+
+	cv::Mat convertImage(const mxArray* matlabStruct, const char* imageStr, const WriteOptions& opt)
+	{
+		return convertImageNode(matlabStruct ? checkImageNode(mxGetField(matlabStruct, 0, imageStr), false) : nullptr, opt);
+	}
+
+	cv::Mat convertVolumeImage(const mxArray* volumeNode, std::size_t slice, const WriteOptions& opt)
 	{
-		const mxArray* imageNode = mxGetField(matlabStruct, 0, imageStr);
-		return convertMatrix<uint8_t>(imageNode);
+		if(opt.imagesTransposed)
+			return opt.copyImages ? wrapTransposedVolumeSlice(volumeNode, slice).clone() : wrapTransposedVolumeSlice(volumeNode, slice);
+		return convertVolumeSlice(volumeNode, slice);
 	}
 
 
-	std::unique_ptr<OctData::SloImage> readSlo(const mxArray* sloNode)
+	std::unique_ptr<OctData::SloImage> readSlo(const mxArray* sloNode, const WriteOptions& opt)
 	{
-		cv::Mat sloImage = convertImage(sloNode, "image");
+		CallStatistics::Timer timer(opt.statistics, "readSlo");
+		Trace::Scope          scope("readSlo");
+
+		cv::Mat sloImage = convertImage(sloNode, "image", opt);
 		if(sloImage.empty())
 			return nullptr;
 
@@ -71,67 +151,358 @@ namespace
 		return slo;
 	}
 
-	void readSegmentation(const mxArray* segNode, OctData::Segmentationlines& seglines)
+	std::shared_ptr<OctData::BScan> readBScan(const mxArray* bscanNode, const cv::Mat& bscanImg, const cv::Mat& imageAngio, const OctData::BScan::Data& bscanData)
+	{
+		if(bscanImg.empty())
+			return nullptr;
+
+		std::shared_ptr<OctData::BScan> bscan = std::make_shared<OctData::BScan>(bscanImg, bscanData);
+
+		if(!imageAngio.empty())
+			bscan->setAngioImage(imageAngio);
+
+		if(bscanNode)
+			readDataNode(bscanNode, *bscan);
+		return bscan;
+	}
+
+
+	std::size_t getNumSlices(const mxArray* volumeNode)
+	{
+		if(!volumeNode || mxIsEmpty(volumeNode))
+			return 0;
+		return mxGetNumberOfDimensions(volumeNode) > 2 ? mxGetDimensions(volumeNode)[2] : 1;
+	}
+
+	const mxArray* checkSegmentlineNode(const mxArray* segNode, const char* name)
 	{
-		ParameterFromOptions get(segNode);
-		for(OctData::Segmentationlines::SegmentlineType type : OctData::Segmentationlines::getSegmentlineTypes())
+		if(!segNode || mxIsNumeric(segNode) || mxIsLogical(segNode))
+			return segNode;
+		mexPrintf("segmentation %s: unhandled type: %d\n", name, static_cast<int>(mxGetClassID(segNode)));
+		return nullptr;
+	}
+
+	typedef OctData::Segmentationlines::Segmentline Segmentline;
+
+	template<typename T>
+	bool isMissingValue(T value)
+	{
+		return std::isnan(value);
+	}
+
+	template<>
+	bool isMissingValue<std::int16_t>(std::int16_t value)
+	{
+		return value == ConvertKernel::int16Missing;
+	}
+
+	// double, single and int16 (scaled with 1/int16Scale, -32768 -> NaN) with the conversion kernels, other classes element wise
+	void readSegmentline(const mxArray* segNode, double int16Scale, Segmentline& seg)
+	{
+		const std::size_t size = mxGetNumberOfElements(segNode);
+		const void*       data = mxGetData(segNode);
+		switch(mxGetClassID(segNode))
 		{
-			OctData::Segmentationlines::Segmentline& seg = seglines.getSegmentLine(type);
-			get(OctData::Segmentationlines::getSegmentlineName(type), seg);
+			case MatlabType<double>::classID:
+				seg.assign(static_cast<const double*>(data), static_cast<const double*>(data) + size);
+				break;
+			case MatlabType<float>::classID:
+				seg.resize(size);
+				ConvertKernel::convert(static_cast<const float*>(data), seg.data(), size, 0., 1.);
+				break;
+			case MatlabType<std::int16_t>::classID:
+				seg.resize(size);
+				ConvertKernel::convert(static_cast<const std::int16_t*>(data), seg.data(), size, 0., 1./int16Scale);
+				break;
+			default:
+				seg = getValueConvert<Segmentline>(segNode);
 		}
 	}
 
-	std::shared_ptr<OctData::BScan> readBScan(const mxArray* bscanNode)
+	// segmentation of a series as layers x A-scans x B-scans array (readoctdata option segmentationArray)
+	struct SegmentationArray
 	{
-		cv::Mat bscanImg = convertImage(bscanNode, "image");
-		if(bscanImg.empty())
-			return nullptr;
+		const mxArray* values    = nullptr;
+		std::size_t    numLayers = 0;
+		std::size_t    numAScans = 0;
+		std::size_t    numBScans = 0;
+		double         int16Scale = ConvertKernel::int16DefaultScale;
+		std::vector<std::pair<OctData::Segmentationlines::SegmentlineType, std::size_t>> layers; // type, layer index
+
+		// series fields segmentation and segmentationLayers, checked in the main thread
+		static SegmentationArray fromSeries(const mxArray* seriesNode, double int16Scale)
+		{
+			SegmentationArray array;
+			const mxArray* values = mxGetField(seriesNode, 0, "segmentation"      );
+			const mxArray* names  = mxGetField(seriesNode, 0, "segmentationLayers");
+			if(!values || !names || !mxIsCell(names) || mxIsEmpty(values))
+				return array;
+
+			const mxClassID classID = mxGetClassID(values);
+			if(classID != MatlabType<double>::classID && classID != MatlabType<float>::classID && classID != MatlabType<std::int16_t>::classID)
+			{
+				mexPrintf("segmentation: unhandled type: %d\n", static_cast<int>(classID));
+				return array;
+			}
+
+			const mwSize  numDims = mxGetNumberOfDimensions(values);
+			const mwSize* dims    = mxGetDimensions(values);
+			array.values     = values;
+			array.int16Scale = int16Scale;
+			array.numLayers  = dims[0];
+			array.numAScans = dims[1];
+			array.numBScans = numDims > 2 ? dims[2] : 1;
 
-		cv::Mat imageAngio = convertImage(bscanNode, "angioImage");
+			const std::size_t numNames = std::min(array.numLayers, static_cast<std::size_t>(mxGetNumberOfElements(names)));
+			for(std::size_t l = 0; l < numNames; ++l)
+			{
+				const mxArray* name = mxGetCell(names, l);
+				if(!name || !mxIsChar(name))
+					continue;
 
+				const std::string layerName = getScalarConvert<std::string>(name);
+				bool found = false;
+				for(OctData::Segmentationlines::SegmentlineType type : OctData::Segmentationlines::getSegmentlineTypes())
+				{
+					if(layerName == OctData::Segmentationlines::getSegmentlineName(type))
+					{
+						array.layers.emplace_back(type, l);
+						found = true;
+					}
+				}
+				if(!found)
+					mexPrintf("segmentation: unknown layer %s\n", layerName.c_str());
+			}
+			return array;
+		}
+
+		// trailing missing values are padding, a line with only missing values is missing
+		template<typename T>
+		void readLines(const T* data, std::size_t bscan, double scale, OctData::Segmentationlines& seglines) const
+		{
+			for(const std::pair<OctData::Segmentationlines::SegmentlineType, std::size_t>& layer : layers)
+			{
+				const T* in = data + layer.second + numLayers*numAScans*bscan;
+				std::size_t size = numAScans;
+				while(size > 0 && isMissingValue(in[(size - 1)*numLayers]))
+					--size;
+
+				Segmentline& seg = seglines.getSegmentLine(layer.first);
+				seg.resize(size);
+				ConvertKernel::convertStrided(in, numLayers, seg.data(), 1, size, 0., scale);
+			}
+		}
+
+		void readLines(std::size_t bscan, OctData::Segmentationlines& seglines) const
+		{
+			if(!values || bscan >= numBScans)
+				return;
+
+			switch(mxGetClassID(values))
+			{
+				case MatlabType<float>::classID:
+					readLines(static_cast<const float*>(mxGetData(values)), bscan, 1., seglines);
+					break;
+				case MatlabType<std::int16_t>::classID:
+					readLines(static_cast<const std::int16_t*>(mxGetData(values)), bscan, 1./int16Scale, seglines);
+					break;
+				default:
+					readLines(static_cast<const double*>(mxGetData(values)), bscan, 1., seglines);
+			}
+		}
+	};
+
+	// arrays of a series with the data of all B-scans (readoctdata options bscanVolume, bscanTable, segmentationArray)
+	struct BScanArrays
+	{
+		const mxArray*    volume      = nullptr;
+		const mxArray*    volumeAngio = nullptr;
+		const mxArray*    table       = nullptr;
+		SegmentationArray segmentation;
+		double            segmentationScale = ConvertKernel::int16DefaultScale; // int16 segmentation: stored value = depth*segmentationScale
+	};
+
+	// image of a B-scan, as matrix or as slice of a volume
+	struct ImageSource
+	{
+		const mxArray* node   = nullptr;
+		bool           volume = false;
+		std::size_t    slice  = 0;
+
+		cv::Mat convert(const WriteOptions& opt) const
+		{
+			if(!node)
+				return cv::Mat();
+
+			Trace::Scope scope("convertImage");
+			return volume ? convertVolumeImage(node, slice, opt) : convertImageNode(node, opt);
+		}
+	};
+
+	// matlab arrays of one B-scan, the pointers are collected in the main thread, the conversion is thread safe
+	struct BScanSource
+	{
+		std::size_t    index     = 0;
+		const mxArray* bscanNode = nullptr;
+		ImageSource    image;
+		ImageSource    imageAngio;
+		std::vector<std::pair<OctData::Segmentationlines::SegmentlineType, const mxArray*>> segmentlines;
+		const SegmentationArray* segmentationArray = nullptr;
+		double                   segmentationScale = ConvertKernel::int16DefaultScale;
+
+		cv::Mat              bscanImg;
+		cv::Mat              bscanAngio;
 		OctData::BScan::Data bscanData;
 
+		void convert(const WriteOptions& opt)
+		{
+			bscanImg   = image     .convert(opt);
+			bscanAngio = imageAngio.convert(opt);
+			for(const std::pair<OctData::Segmentationlines::SegmentlineType, const mxArray*>& segline : segmentlines)
+				readSegmentline(segline.second, segmentationScale, bscanData.segmentationslines.getSegmentLine(segline.first));
+			if(segmentationArray)
+				segmentationArray->readLines(index, bscanData.segmentationslines);
+		}
+	};
 
-		const mxArray* segNode = mxGetField(bscanNode, 0, "segmentation");
-		if(segNode)
-			readSegmentation(segNode, bscanData.segmentationslines);
+	ImageSource getImageSource(const mxArray* bscanNode, const char* imageStr, const mxArray* volumeNode, std::size_t slice)
+	{
+		ImageSource source;
+		if(volumeNode)
+		{
+			source.node   = checkImageNode(volumeNode, true);
+			source.volume = true;
+			source.slice  = slice;
+		}
+		else if(bscanNode)
+			source.node = checkImageNode(mxGetField(bscanNode, 0, imageStr), false);
+		return source;
+	}
 
-		std::shared_ptr<OctData::BScan> bscan = std::make_shared<OctData::BScan>(bscanImg, bscanData);
+	// B-scans of the cell array bscansNode (empty cells are skipped), the images, data or segmentation are taken from the arrays if given.
+	// Without bscansNode only the images of the volume are added.
+	void readBScans(const mxArray* bscansNode, const BScanArrays& arrays, OctData::Series& series, const WriteOptions& opt)
+	{
+		CallStatistics::Timer timer(opt.statistics, "readBScans");
 
-		if(!imageAngio.empty())
-			bscan->setAngioImage(imageAngio);
+		const std::size_t numBScans = bscansNode ? mxGetNumberOfElements(bscansNode) : getNumSlices(arrays.volume);
 
-		readDataNode(bscanNode, *bscan);
-		return bscan;
+		std::vector<BScanSource> sources;
+		sources.reserve(numBScans);
+		for(std::size_t i = 0; i < numBScans; ++i)
+		{
+			const mxArray* bscanNode = bscansNode ? mxGetCell(bscansNode, i) : nullptr;
+			if(bscansNode && !bscanNode)
+				continue;
+
+			BScanSource source;
+			source.index      = i;
+			source.bscanNode  = bscanNode;
+			source.image      = getImageSource(bscanNode, "image"     , arrays.volume     , i);
+			source.imageAngio = getImageSource(bscanNode, "imageAngio", arrays.volumeAngio, i);
+			if(arrays.segmentation.values)
+				source.segmentationArray = &arrays.segmentation;
+			source.segmentationScale = arrays.segmentationScale;
+
+			const mxArray* segNode = bscanNode ? mxGetField(bscanNode, 0, "segmentation") : nullptr;
+			if(segNode)
+			{
+				for(OctData::Segmentationlines::SegmentlineType type : OctData::Segmentationlines::getSegmentlineTypes())
+				{
+					const char* name = OctData::Segmentationlines::getSegmentlineName(type);
+					const mxArray* segLineNode = checkSegmentlineNode(mxGetField(segNode, 0, name), name);
+					if(segLineNode)
+						source.segmentlines.emplace_back(type, segLineNode);
+				}
+			}
+
+			sources.push_back(std::move(source));
+		}
+
+		{
+			CallStatistics::Timer convertTimer(opt.statistics, "convertBScans");
+			parallelFor(sources.size(), getNumThreads(opt.numThreads), [&sources, &opt](std::size_t i)
+				{
+					Trace::Scope scope("convertBScan", static_cast<std::int64_t>(sources[i].index));
+					sources[i].convert(opt);
+				});
+		}
+
+		for(BScanSource& source : sources)
+		{
+			std::shared_ptr<OctData::BScan> bscan = readBScan(source.bscanNode, source.bscanImg, source.bscanAngio, source.bscanData);
+			if(bscan)
+			{
+				if(arrays.table)
+				{
+					ParameterFromTable fromTable(arrays.table, source.index);
+					bscan->getSetParameter(fromTable);
+				}
+				series.addBScan(std::move(bscan));
+			}
+
+			source.bscanImg  .release();
+			source.bscanAngio.release();
+			source.bscanData = OctData::BScan::Data();
+		}
 	}
 
+	// series field segmentationScale (int16 segmentation), the default of readoctdata if the field is missing
+	double getSegmentationScale(const mxArray* seriesNode)
+	{
+		const mxArray* scaleNode = seriesNode ? mxGetField(seriesNode, 0, "segmentationScale") : nullptr;
+		if(!scaleNode || mxIsEmpty(scaleNode))
+			return ConvertKernel::int16DefaultScale;
+
+		const double scale = mxIsNumeric(scaleNode) ? getScalarConvert<double>(scaleNode) : 0.;
+		if(!(scale > 0) || !std::isfinite(scale))
+			mexErrMsgIdAndTxt("MATLAB:mexcpp:segmentationScale", "segmentationScale: has to be a positive number");
+		return scale;
+	}
 
-	bool readBScanList(const mxArray* seriesNode, OctData::Series& series)
+	bool readBScanList(const mxArray* seriesNode, OctData::Series& series, const WriteOptions& opt)
 	{
 		const mxArray* bscansNode = mxGetField(seriesNode, 0, "bscans");
 		if(!bscansNode || !mxIsCell(bscansNode))
 			return false;
 
-		const mwSize* numSubStruct = mxGetDimensions(bscansNode);
-		const mwSize numBScans = numSubStruct[0] * numSubStruct[1];
+		// images as rows x cols x N array (readoctdata option bscanVolume)
+		BScanArrays arrays;
+		arrays.volume       = mxGetField(seriesNode, 0, "volume"     );
+		arrays.volumeAngio  = mxGetField(seriesNode, 0, "volumeAngio");
+		arrays.table        = mxGetField(seriesNode, 0, "bscanData"  );
 
-		for(mwSize i = 0; i < numBScans; ++i)
-		{
-		    const mxArray* bscanNode = mxGetCell(bscansNode, i);
+		arrays.segmentationScale = getSegmentationScale(seriesNode);
+		arrays.segmentation      = SegmentationArray::fromSeries(seriesNode, arrays.segmentationScale);
 
-			std::shared_ptr<OctData::BScan> bscan = readBScan(bscanNode);
-			if(bscan)
-				series.addBScan(std::move(bscan));
-		}
+		readBScans(bscansNode, arrays, series, opt);
 
 		return true;
 	}
 
+	// id of a substructure field (e.g. Series_7 -> 7), false for other fields
 	template<typename S>
-	bool readStructure(const mxArray* matlabStruct, S& structure)
+	bool getSubstructureId(const char* fieldName, int& id)
 	{
 		static const std::string subStructureName = getSubStructureName<S>();
 
+		if(memcmp(fieldName, subStructureName.c_str(), subStructureName.size()) != 0 || strlen(fieldName) <= subStructureName.size())
+			return false;
+
+		try
+		{
+			id = boost::lexical_cast<int>(std::string(fieldName).substr(subStructureName.size()+1));
+		}
+		catch(const boost::bad_lexical_cast&)
+		{
+			return false;
+		}
+		return true;
+	}
+
+	template<typename S>
+	bool readStructure(const mxArray* matlabStruct, S& structure, const WriteOptions& opt)
+	{
 		readDataNode(matlabStruct, structure);
 
 		bool result = true;
@@ -139,19 +510,12 @@ namespace
 		const int numSubStruct = mxGetNumberOfFields(matlabStruct);
 		for(int i = 0; i < numSubStruct; ++i)
 		{
-			const char* subStructName = mxGetFieldNameByNumber(matlabStruct, i);
-			if(memcmp(subStructName, subStructureName.c_str(), subStructureName.size()) == 0)
+			int id = 0;
+			if(getSubstructureId<S>(mxGetFieldNameByNumber(matlabStruct, i), id))
 			{
-				std::string subNumberStr = std::string(subStructName).substr(subStructureName.size()+1);
-				try
-				{
-					const int id = boost::lexical_cast<int>(subNumberStr);
-					const mxArray* subArray = mxGetFieldByNumber(matlabStruct, 0, i);
-					result &= readStructure(subArray, structure.getInsertId(id));
-				}
-				catch(...)
-				{
-				}
+				// errors of the substructure (e.g. invalid images) are passed on
+				const mxArray* subArray = mxGetFieldByNumber(matlabStruct, 0, i);
+				result &= readStructure(subArray, structure.getInsertId(id), opt);
 			}
 		}
 
@@ -160,47 +524,299 @@ namespace
 
 
 	template<>
-	bool readStructure<OctData::Series>(const mxArray* matlabStruct, OctData::Series& series)
+	bool readStructure<OctData::Series>(const mxArray* matlabStruct, OctData::Series& series, const WriteOptions& opt)
 	{
 		readDataNode(matlabStruct, series);
 
 
 		const mxArray* sloNode = mxGetField(matlabStruct, 0, "slo");
 		if(sloNode)
-			series.takeSloImage(readSlo(sloNode));
+			series.takeSloImage(readSlo(sloNode, opt));
+
+		return readBScanList(matlabStruct, series, opt);
+	}
+
+
+	// id of the first substructure, 1 if there is none
+	template<typename S>
+	typename S::SubstructureType& getFirstSubstructure(S& structure)
+	{
+		const int id = structure.begin() != structure.end() ? structure.begin()->first : 1;
+		return structure.getInsertId(id);
+	}
+
+	// matlab node of the substructure with the lowest id (as getFirstSubstructure), nullptr if there is none
+	template<typename S>
+	const mxArray* getFirstSubstructureNode(const mxArray* matlabStruct)
+	{
+		if(!matlabStruct || !mxIsStruct(matlabStruct))
+			return nullptr;
+
+		const mxArray* node  = nullptr;
+		int            minId = 0;
+		const int numSubStruct = mxGetNumberOfFields(matlabStruct);
+		for(int i = 0; i < numSubStruct; ++i)
+		{
+			int id = 0;
+			if(getSubstructureId<S>(mxGetFieldNameByNumber(matlabStruct, i), id) && (!node || id < minId))
+			{
+				node  = mxGetFieldByNumber(matlabStruct, 0, i);
+				minId = id;
+			}
+		}
+		return node;
+	}
+
+	// file written in parts: writeoctdata('open', ...), writeoctdata('append', ...), writeoctdata('close', ...)
+	struct StreamWriter
+	{
+		std::string               filename;
+		OctData::FileWriteOptions options;
+		WriteOptions              writeOptions;
+		OctData::OCT              oct;
+		OctData::Series*          series = nullptr; // the B-scans are appended to this series of oct
+		double                    segmentationScale = ConvertKernel::int16DefaultScale; // series field segmentationScale of the header
+	};
+
+
+	// state of the mex module, kept between the calls
+	std::map<std::uint64_t, std::unique_ptr<StreamWriter>> streamWriters;
+	std::uint64_t                                          nextHandle = 1;
+	bool                                                   mexLocked  = false;
+
+	void updateMexLock()
+	{
+		const bool needLock = !streamWriters.empty();
+		if(needLock && !mexLocked)
+			mexLock();
+		else if(!needLock && mexLocked)
+			mexUnlock();
+		mexLocked = needLock;
+	}
+
+	void cleanupModule()
+	{
+		streamWriters.clear();
+	}
+
+	void registerCleanup()
+	{
+		static bool registered = false;
+		if(!registered)
+			mexAtExit(&cleanupModule);
+		registered = true;
+	}
+
+	bool writeFile(const std::string& filename, const OctData::OCT& oct, const OctData::FileWriteOptions& options)
+	{
+		Trace::Scope scope("writeFile");
+		return OctData::OctFileRead::writeFile(filename, oct, options);
+	}
+
+	void finishTrace(Trace::Session& trace, const WriteOptions& opt)
+	{
+		if(!trace.finish())
+			mexPrintf("traceFile: can not write %s\n", opt.traceFile.c_str());
+	}
+
+	void loadOptions(const mxArray* mxOptions, OctData::FileWriteOptions& options, WriteOptions& writeOptions)
+	{
+		if(mxOptions && mxIsStruct(mxOptions))
+		{
+			ParameterFromOptions paraFromOptions(mxOptions);
+			options.getSetParameter(paraFromOptions);
+			writeOptions.getSetParameter(paraFromOptions);
+		}
+	}
+
+	std::map<std::uint64_t, std::unique_ptr<StreamWriter>>::iterator findStreamWriter(const mxArray* mxHandle)
+	{
+		std::uint64_t handle = 0;
+		if(!getHandle(mxHandle, handle))
+			mexErrMsgIdAndTxt("MATLAB:mexcpp:handle", "writeoctdata handle has to be a positive integer");
+
+		std::map<std::uint64_t, std::unique_ptr<StreamWriter>>::iterator it = streamWriters.find(handle);
+		if(it == streamWriters.end())
+			mexErrMsgIdAndTxt("MATLAB:mexcpp:handle", "invalid writeoctdata handle");
+
+		return it;
+	}
+
+	StreamWriter& getStreamWriter(const mxArray* mxHandle)
+	{
+		return *findStreamWriter(mxHandle)->second;
+	}
+
+
+	// command interface: writeoctdata(command, arguments...)
+	// h = writeoctdata('open', filename, header, [options]), header: structure as from readoctdata without B-scans (may be [])
+	void openCommand(int /*nlhs*/, mxArray* plhs[], int nrhs, const mxArray* prhs[])
+	{
+		if(nrhs < 2 || nrhs > 3 || !mxIsChar(prhs[0]))
+		{
+			mexErrMsgIdAndTxt("MATLAB:mexcpp:nargin", "usage: handle = writeoctdata('open', filename, header, [options])");
+			return;
+		}
+
+		std::unique_ptr<StreamWriter> writer = std::make_unique<StreamWriter>();
+		writer->filename = getScalarConvert<std::string>(prhs[0]);
+		loadOptions(nrhs == 3 ? prhs[2] : nullptr, writer->options, writer->writeOptions);
+		writer->writeOptions.copyImages = true; // the matlab arrays may be freed after each call
+
+		if(mxIsStruct(prhs[1]))
+			readStructure(prhs[1], writer->oct, writer->writeOptions);
+		writer->series = &getFirstSubstructure(getFirstSubstructure(getFirstSubstructure(writer->oct)));
 
-		return readBScanList(matlabStruct, series);
+		const mxArray* patientNode = getFirstSubstructureNode<OctData::OCT    >(prhs[1]);
+		const mxArray* studyNode   = getFirstSubstructureNode<OctData::Patient>(patientNode);
+		writer->segmentationScale  = getSegmentationScale(getFirstSubstructureNode<OctData::Study>(studyNode));
+
+		const std::uint64_t handle = nextHandle++;
+		streamWriters.emplace(handle, std::move(writer));
+		updateMexLock();
+
+		plhs[0] = mxCreateDoubleScalar(static_cast<double>(handle));
 	}
 
+	// writeoctdata('append', h, bscans) with a cell array of B-scan structures
+	// writeoctdata('append', h, volume, [bscans]) with the images as array (rows x cols x N) and optional the data and segmentation
+	void appendCommand(int /*nlhs*/, mxArray* /*plhs*/[], int nrhs, const mxArray* prhs[])
+	{
+		if(nrhs < 2 || nrhs > 3)
+		{
+			mexErrMsgIdAndTxt("MATLAB:mexcpp:nargin", "usage: writeoctdata('append', handle, bscans[cell]) or writeoctdata('append', handle, volume, [bscans[cell]])");
+			return;
+		}
+
+		StreamWriter& writer = getStreamWriter(prhs[0]);
+
+		const mxArray* volumeNode = mxIsCell(prhs[1]) ? nullptr : prhs[1];
+		const mxArray* bscansNode = mxIsCell(prhs[1]) ? prhs[1] : (nrhs == 3 ? prhs[2] : nullptr);
+
+		if(bscansNode && !mxIsCell(bscansNode))
+		{
+			mexErrMsgIdAndTxt("MATLAB:mexcpp:nargin", "append: bscans has to be a cell array");
+			return;
+		}
+		if(volumeNode && bscansNode && getNumSlices(volumeNode) != mxGetNumberOfElements(bscansNode))
+		{
+			mexErrMsgIdAndTxt("MATLAB:mexcpp:nargin", "append: number of images and B-scans differ");
+			return;
+		}
+
+		BScanArrays arrays;
+		arrays.volume            = volumeNode;
+		arrays.segmentationScale = writer.segmentationScale;
+		readBScans(bscansNode, arrays, *writer.series, writer.writeOptions);
+	}
+
+	// writeoctdata('close', h, [filename]): writes the file (to filename if given, '' discards the B-scans without writing)
+	// the handle is released only if the file was written, after an error 'close' can be called again
+	void closeCommand(int /*nlhs*/, mxArray* /*plhs*/[], int nrhs, const mxArray* prhs[])
+	{
+		if(nrhs < 1 || nrhs > 2 || (nrhs == 2 && !mxIsChar(prhs[1])))
+		{
+			mexErrMsgIdAndTxt("MATLAB:mexcpp:nargin", "usage: writeoctdata('close', handle, [filename])");
+			return;
+		}
+
+		std::map<std::uint64_t, std::unique_ptr<StreamWriter>>::iterator it = findStreamWriter(prhs[0]);
+		StreamWriter& writer = *it->second;
+		if(nrhs == 2)
+			writer.filename = getScalarConvert<std::string>(prhs[1]);
+
+		if(!writer.filename.empty())
+		{
+			Trace::Session trace(writer.writeOptions.traceFile);
+			bool        written = false;
+			std::string error   = "write failed";
+			try
+			{
+				written = writeFile(writer.filename, writer.oct, writer.options);
+			}
+			catch(const std::exception& e)
+			{
+				error = e.what();
+			}
+			finishTrace(trace, writer.writeOptions);
+
+			if(!written)
+			{
+				mexErrMsgIdAndTxt("MATLAB:mexcpp:write", "close: can not write %s (%s), the handle stays open", writer.filename.c_str(), error.c_str());
+				return;
+			}
+		}
+
+		streamWriters.erase(it);
+		updateMexLock();
+	}
+
+	bool isCommand(const std::string& name)
+	{
+		return name == "open"
+		    || name == "append"
+		    || name == "close";
+	}
+
+	void runCommand(const std::string& command, int nlhs, mxArray* plhs[], int nrhs, const mxArray* prhs[])
+	{
+		if(command == "open")
+			openCommand(nlhs, plhs, nrhs, prhs);
+		else if(command == "append")
+			appendCommand(nlhs, plhs, nrhs, prhs);
+		else if(command == "close")
+			closeCommand(nlhs, plhs, nrhs, prhs);
+	}
 }
 
 
 
+// conversion to an OCT without writing a file (benchmark), mxOptions as for writeoctdata(filename, data, options).
+// with imagesTransposed the images refer to the memory of data
+void convertMatlabData(const mxArray* data, const mxArray* mxOptions, OctData::OCT& oct)
+{
+	OctData::FileWriteOptions options;
+	WriteOptions writeOptions;
+	loadOptions(mxOptions, options, writeOptions);
+
+	readStructure(data, oct, writeOptions);
+}
+
 
-mxArray* writeOctData(const mxArray* mxOptions, const mxArray* data, const std::string& filename)
+mxArray* writeOctData(const mxArray* mxOptions, const mxArray* data, const std::string& filename, CallStatistics* statistics = nullptr)
 {
+	CallStatistics::Timer timer(statistics, "writeOctData");
+
 	// Load Options
 	OctData::FileWriteOptions options;
-
-	if(mxOptions && mxIsStruct(mxOptions))
-	{
-		ParameterFromOptions paraFromOptions(mxOptions);
-		options.getSetParameter(paraFromOptions);
-	}
+	WriteOptions writeOptions;
+	loadOptions(mxOptions, options, writeOptions);
+	writeOptions.statistics = statistics;
 
 	if(filename.empty())
 	{
 		ParameterToOptions paraToOptions;
 		options.getSetParameter(paraToOptions);
+		writeOptions.getSetParameter(paraToOptions);
 		return paraToOptions.getMxOptions();
 	}
 
 
-	OctData::OCT oct;
-	readStructure(data, oct);
+	// with imagesTransposed the images refer to the memory of data
+	Trace::Session trace(writeOptions.traceFile);
 
-	OctData::OctFileRead::writeFile(filename, oct, options);
+	OctData::OCT oct;
+	{
+		CallStatistics::Timer readTimer(statistics, "readStructure");
+		Trace::Scope          readScope("readStructure");
+		readStructure(data, oct, writeOptions);
+	}
+	{
+		CallStatistics::Timer writeTimer(statistics, "writeFile");
+		writeFile(filename, oct, options);
+	}
 
+	finishTrace(trace, writeOptions);
 	return nullptr;
 }
 
@@ -211,6 +827,19 @@ void mexFunction(int            nlhs
                , int            nrhs
                , const mxArray* prhs[])
 {
+	registerCleanup();
+
+	// data is always a struct, so writeoctdata(command, arguments...) does not collide with writeoctdata(filename, data, options)
+	if(nrhs >= 2 && mxIsChar(prhs[0]) && !mxIsStruct(prhs[1]))
+	{
+		const std::string command = getScalarConvert<std::string>(prhs[0]);
+		if(isCommand(command))
+		{
+			runCommand(command, nlhs, plhs, nrhs - 1, prhs + 1);
+			return;
+		}
+	}
+
 	/* Check for proper number of arguments */
 	if(nrhs > 3 || nrhs < 2)
 	{
@@ -225,9 +854,9 @@ void mexFunction(int            nlhs
 
 	std::string filename = getScalarConvert<std::string>(prhs[0]);
 
-	if(nlhs != 0 && !filename.empty())
+	if(nlhs > 1)
 	{
-		mexErrMsgIdAndTxt("MATLAB:mexcpp:nargout", "MEXCPP requires only one output argument.");
+		mexErrMsgIdAndTxt("MATLAB:mexcpp:nargout", "MEXCPP requires at most one output argument (statistics).");
 		return;
 	}
 
@@ -237,7 +866,14 @@ void mexFunction(int            nlhs
 		mxOptions = prhs[2];
 
 
-	plhs[0] = writeOctData(mxOptions, prhs[1], filename);
+	if(nlhs > 0 && !filename.empty())
+	{
+		CallStatistics statistics;
+		writeOctData(mxOptions, prhs[1], filename, &statistics);
+		plhs[0] = statistics.getMxArray(prhs[1]);
+	}
+	else
+		plhs[0] = writeOctData(mxOptions, prhs[1], filename);
 
 	return;
 }